@@ -0,0 +1,77 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+// Monotonic bump allocator for data that lives until the process exits.
+// Memory is taken from the kernel in large chunks and never given back; deallocate() only
+// reclaims the most recent allocation, which is enough to make growing strings and vectors cheap.
+// Not thread-safe: allocate from one thread only.
+class arena {
+public:
+    static constexpr std::size_t chunk_size = 64 << 20;
+    static constexpr std::size_t huge_page_size = 2 << 20;
+
+    void* allocate(std::size_t n, std::size_t align) {
+        std::uintptr_t p = (m_pos + align - 1) & ~(align - 1);
+        if (p + n > m_end) {
+            refill(n + align);
+            p = (m_pos + align - 1) & ~(align - 1);
+        }
+        m_pos = p + n;
+        return reinterpret_cast<void*>(p);
+    }
+
+    void deallocate(void* p, std::size_t n) {
+        if (reinterpret_cast<std::uintptr_t>(p) + n == m_pos)
+            m_pos = reinterpret_cast<std::uintptr_t>(p);
+    }
+
+    // Back subsequent chunks with transparent huge pages (when the kernel allows it).
+    void use_huge_pages(bool value) { m_huge_pages = value; }
+
+private:
+    void refill(std::size_t n) {
+        std::size_t size = n > chunk_size ? (n + huge_page_size - 1) & ~(huge_page_size - 1) : chunk_size;
+        // Over-map by one huge page so the chunk can start on a huge page boundary.
+        void* p = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        m_pos = (reinterpret_cast<std::uintptr_t>(p) + huge_page_size - 1) & ~(huge_page_size - 1);
+        m_end = m_pos + size;
+        if (m_huge_pages)
+            madvise(reinterpret_cast<void*>(m_pos), size, MADV_HUGEPAGE);
+    }
+
+    std::uintptr_t m_pos = 0;
+    std::uintptr_t m_end = 0;
+    bool m_huge_pages = false;
+};
+
+inline arena s_arena;
+
+// Stateless allocator on top of s_arena, usable as nlohmann::basic_json's AllocatorType.
+template<class T>
+struct arena_allocator {
+    using value_type = T;
+
+    arena_allocator() = default;
+    template<class U> arena_allocator(const arena_allocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(s_arena.allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        s_arena.deallocate(p, n * sizeof(T));
+    }
+
+    template<class U> bool operator==(const arena_allocator<U>&) const { return true; }
+    template<class U> bool operator!=(const arena_allocator<U>&) const { return false; }
+};
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs every converter over every input a number of times and reports throughput, memory and CPU use,
+// and speedup against the reference converter. Every output is checked against the reference output.
+
+struct run_result {
+    double seconds = 0;
+    double cpu_seconds = 0;
+    long max_rss_kb = 0;
+    std::uint64_t output_hash = 0;
+    std::uint64_t output_bytes = 0;
+    std::uint64_t items = 0;
+    bool exited_ok = false;
+    bool input_failed = false;  // the child could not open the input
+};
+
+struct row {
+    std::string converter;
+    std::string input;
+    std::uint64_t input_bytes;
+    std::vector<run_result> runs;
+    bool matches_reference;
+};
+
+std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> ret;
+    std::istringstream is(s);
+    for (std::string part; std::getline(is, part, sep);)
+        if (not part.empty())
+            ret.push_back(part);
+    return ret;
+}
+
+bool drop_caches() {
+    sync();
+    std::ofstream os("/proc/sys/vm/drop_caches");
+    return bool(os << "3" << std::flush);
+}
+
+// Counts the top-level items of an XML stream fed to it byte by byte: the elements that open at depth 1,
+// inside the document element, whatever the layout. Text never contains '<' (it's escaped), and the
+// converters write no attributes, so a '>' always ends the tag it's in.
+class item_counter {
+public:
+    void operator()(char c) {
+        if (not in_tag) {
+            if (c == '<') {
+                in_tag = true;
+                kind = tag::unknown;
+            }
+        }
+        else if (kind == tag::unknown) {
+            kind = c == '/' ? tag::close : c == '?' or c == '!' ? tag::other : tag::open;
+            if (kind == tag::open and depth++ == 1)
+                items++;
+        }
+        else if (c == '>') {
+            if (kind == tag::close or (kind == tag::open and prev == '/'))
+                depth--;
+            in_tag = false;
+        }
+        prev = c;
+    }
+
+    std::uint64_t items = 0;
+
+private:
+    enum class tag { unknown, open, close, other };
+    bool in_tag = false;
+    tag kind = tag::unknown;
+    char prev = 0;
+    long depth = 0;
+};
+
+// Exit status of the child when it cannot open the input, so that it is not mistaken for the converter's.
+constexpr int input_failed_status = 126;
+
+// Runs `command` with `input` on stdin, hashing its stdout on the fly (FNV-1a) and counting the top-level
+// items.
+run_result run(const std::string& command, const std::string& input) {
+    run_result ret;
+    std::vector<std::string> args = split(command, ' ');
+    if (args[0].find('/') == std::string::npos)
+        args[0] = "./" + args[0];
+    std::vector<char*> argv;
+    for (auto& a : args)
+        argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    int out[2];
+    if (pipe(out))
+        return ret;
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int in = open(input.c_str(), O_RDONLY);
+        if (in < 0)
+            _exit(input_failed_status);
+        dup2(in, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(out[1]);
+
+    std::uint64_t hash = 14695981039346656037ull;
+    item_counter count_items;
+    char buf[1 << 16];
+    for (ssize_t n; (n = read(out[0], buf, sizeof(buf))) > 0;) {
+        ret.output_bytes += n;
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            hash = (hash ^ std::uint8_t(c)) * 1099511628211ull;
+            count_items(c);
+        }
+    }
+    close(out[0]);
+    ret.items = count_items.items;
+
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    ret.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    ret.cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    ret.max_rss_kb = usage.ru_maxrss;
+    ret.output_hash = hash;
+    ret.exited_ok = WIFEXITED(status) and WEXITSTATUS(status) == 0;
+    ret.input_failed = WIFEXITED(status) and WEXITSTATUS(status) == input_failed_status;
+    return ret;
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0 : v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
+
+int main(int argc, const char** argv) {
+    const char* prog_name = argv[0];
+    auto usage = [&](int ret) {
+        std::cerr << "Usage: " << prog_name << " [option*] input*\n"
+                << "Options are:\n"
+                << "  -h|--help         Display this help message\n"
+                << "  -r|--repeat N     Runs per converter and input (default 3), the median is reported\n"
+                << "  --reference cmd   Converter that defines the expected output and speedup 1.0 (default impl2-orig)\n"
+                << "  --run cmd         Converter command line to benchmark, may be repeated\n"
+                << "  --format csv|json Report format (default csv)\n"
+                << "  -o|--output file  Write the report to file instead of stdout\n"
+                << "  --no-drop-caches  Do not try to drop the page cache before every run\n"
+                << "Exits with a non-zero status when any output differs from the reference.\n";
+        return ret;
+    };
+    int repeat = 3;
+    std::string reference = "impl2-orig";
+    std::vector<std::string> converters;
+    std::vector<std::string> inputs;
+    bool json = false;
+    bool want_drop_caches = true;
+    const char* output = nullptr;
+    while (++argv, --argc)
+    {
+        if (not std::strcmp(argv[0], "-h") or not std::strcmp(argv[0], "--help"))
+            return usage(0);
+        else if (not std::strcmp(argv[0], "-r") or not std::strcmp(argv[0], "--repeat"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            repeat = std::max(1, std::atoi(argv[0]));
+        }
+        else if (not std::strcmp(argv[0], "--reference"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            reference = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--run"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            converters.push_back(argv[0]);
+        }
+        else if (not std::strcmp(argv[0], "--format"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            if (not std::strcmp(argv[0], "json"))
+                json = true;
+            else if (not std::strcmp(argv[0], "csv"))
+                json = false;
+            else
+                return usage(1);
+        }
+        else if (not std::strcmp(argv[0], "-o") or not std::strcmp(argv[0], "--output"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            output = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--no-drop-caches"))
+            want_drop_caches = false;
+        else if (argv[0][0] == '-')
+            return usage(1);
+        else
+            inputs.push_back(argv[0]);
+    }
+    if (inputs.empty())
+        return usage(1);
+    converters.insert(converters.begin(), reference);
+
+    bool can_drop_caches = want_drop_caches and drop_caches();
+    if (want_drop_caches and not can_drop_caches)
+        std::cerr << prog_name << ": cannot drop the page cache, running with warm caches\n";
+
+    std::vector<row> rows;
+    bool all_match = true;
+    for (const auto& input : inputs) {
+        struct stat st;
+        if (stat(input.c_str(), &st)) {
+            std::cerr << prog_name << ": cannot open " << input << "\n";
+            return 1;
+        }
+        run_result expected;
+        for (const auto& converter : converters) {
+            row r{ converter, input, std::uint64_t(st.st_size), {}, true };
+            for (int i = 0; i < repeat; i++) {
+                if (can_drop_caches)
+                    drop_caches();
+                std::cerr << "Running " << converter << " <" << input << " (" << i + 1 << "/" << repeat << ")...\n";
+                run_result result = run(converter, input);
+                if (result.input_failed)
+                    std::cerr << prog_name << ": cannot open " << input << " for " << converter << "\n";
+                if (&converter == &converters.front() and i == 0)
+                    expected = result;
+                if (not result.exited_ok or result.output_hash != expected.output_hash
+                        or result.output_bytes != expected.output_bytes)
+                    r.matches_reference = false;
+                r.runs.push_back(result);
+            }
+            if (not r.matches_reference) {
+                std::cerr << "\e[31m[FAIL]  " << converter << " <" << input << ": output differs from "
+                          << reference << "\e[39m\n";
+                all_match = false;
+            }
+            rows.push_back(std::move(r));
+        }
+    }
+
+    std::ofstream file;
+    if (output)
+        file.open(output);
+    std::ostream& os = output ? file : std::cout;
+    os << std::fixed << std::setprecision(3);
+    if (not json)
+        os << "converter,input,input_mb,runs,seconds,mb_per_s,items_per_s,peak_rss_mb,cpu_utilisation,speedup,output_ok\n";
+    else
+        os << "[\n";
+    double reference_seconds = 0;
+    for (std::size_t i = 0; i < rows.size(); i++) {
+        const row& r = rows[i];
+        std::vector<double> seconds, cpu;
+        long rss = 0;
+        for (const auto& run : r.runs) {
+            seconds.push_back(run.seconds);
+            cpu.push_back(run.cpu_seconds / run.seconds);
+            rss = std::max(rss, run.max_rss_kb);
+        }
+        double t = median(seconds);
+        if (i % converters.size() == 0) // the reference comes first for every input
+            reference_seconds = t;
+        double mb = r.input_bytes / 1e6;
+        double items = r.runs.front().items;
+        if (not json)
+            os << r.converter << "," << r.input << "," << mb << "," << r.runs.size() << "," << t << "," << mb / t
+               << "," << items / t << "," << rss / 1024.0 << "," << median(cpu) << "," << reference_seconds / t
+               << "," << (r.matches_reference ? "yes" : "no") << "\n";
+        else
+            os << "  {\"converter\":\"" << r.converter << "\",\"input\":\"" << r.input << "\",\"input_mb\":" << mb
+               << ",\"runs\":" << r.runs.size() << ",\"seconds\":" << t << ",\"mb_per_s\":" << mb / t
+               << ",\"items_per_s\":" << items / t << ",\"peak_rss_mb\":" << rss / 1024.0
+               << ",\"cpu_utilisation\":" << median(cpu) << ",\"speedup\":" << reference_seconds / t
+               << ",\"output_ok\":" << (r.matches_reference ? "true" : "false") << "}"
+               << (i + 1 < rows.size() ? ",\n" : "\n");
+    }
+    if (json)
+        os << "]\n";
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#ifndef CACHE_ALIGNED_H_
+#define CACHE_ALIGNED_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Smallest distance that keeps two objects written by different threads from sharing a cache line.
+// CMake defines HAVE_HARDWARE_INTERFERENCE_SIZE when the standard library knows it, and CACHE_LINE_SIZE
+// (the build machine's) when it doesn't.
+#if defined(HAVE_HARDWARE_INTERFERENCE_SIZE)
+inline constexpr std::size_t cache_line_size = std::hardware_destructive_interference_size;
+#elif defined(CACHE_LINE_SIZE)
+inline constexpr std::size_t cache_line_size = CACHE_LINE_SIZE;
+#else
+inline constexpr std::size_t cache_line_size = 64;
+#endif
+
+// A T that starts on a cache line and has it to itself: sizeof is rounded up to whole lines, so arrays of
+// cache_aligned<T> don't share lines either.
+template<class T>
+struct alignas(cache_line_size) cache_aligned {
+    // Not a copy or move constructor: those stay the implicit ones.
+    template<class... Args, class = std::enable_if_t<not (sizeof...(Args) == 1
+                                                          and (std::is_same_v<std::decay_t<Args>, cache_aligned> and ...))>>
+    explicit cache_aligned(Args&&... args) : value(std::forward<Args>(args)...) {}
+
+    T& operator*() { return value; }
+    const T& operator*() const { return value; }
+    T* operator->() { return &value; }
+    const T* operator->() const { return &value; }
+
+    T value;
+};
+
+// One T per thread, indexed by a thread number the caller hands out, each on `Lines` cache lines of its own.
+// Lines = 2 also keeps neighbours apart on CPUs whose prefetcher fetches lines in adjacent pairs.
+template<class T, std::size_t Lines = 1>
+class per_thread {
+public:
+    explicit per_thread(std::size_t threads) : n(threads), slots(new slot[threads]) {}
+
+    T& operator[](std::size_t thread) { return slots[thread].value; }
+    const T& operator[](std::size_t thread) const { return slots[thread].value; }
+
+    std::size_t size() const { return n; }
+
+    // Combine all threads' values, e.g. to sum up per-thread counts.
+    template<class U, class F>
+    U reduce(U init, F f) const {
+        for (std::size_t i = 0; i < n; i++)
+            init = f(std::move(init), slots[i].value);
+        return init;
+    }
+
+private:
+    struct alignas(Lines * cache_line_size) slot {
+        T value{};
+    };
+
+    std::size_t n;
+    std::unique_ptr<slot[]> slots;
+};
+
+#endif /* CACHE_ALIGNED_H_ */
@@ -0,0 +1,278 @@
+#ifndef CORO_PIPELINE_H_
+#define CORO_PIPELINE_H_
+
+#include "pipeline.h"
+#include <array>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Single-threaded drop-in for pipeline<Stage>: the lanes and the sink run as coroutines on the thread that
+// pushes the tokens. Meant for hosts with one or two cores, where a thread per stage mostly buys context switches.
+// All counters are kept per lane as in pipeline, but nothing ever blocks, so there are no wait times.
+// Every lane still gets a trace track of its own, showing when it ran.
+
+class coro_scheduler {
+public:
+    void schedule(std::coroutine_handle<> h) {
+        ready.push_back(h);
+    }
+
+    bool run_one() {
+        if (ready.empty())
+            return false;
+        auto h = ready.front();
+        ready.pop_front();
+        h.resume();
+        return true;
+    }
+
+private:
+    std::deque<std::coroutine_handle<>> ready;
+};
+
+struct coro_task {
+    struct promise_type {
+        coro_task get_return_object() { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    coro_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    coro_task(coro_task&& other) : handle(std::exchange(other.handle, nullptr)) {}
+    ~coro_task() { if (handle) handle.destroy(); }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Same ring buffer as fifo, but push() and pop() are awaited: instead of sleeping, the awaiting coroutine
+// is suspended until the other side has made room or data.
+template<typename T, std::size_t N>
+class coro_fifo {
+public:
+    explicit coro_fifo(coro_scheduler& s) : scheduler(s) {}
+
+    auto push(T&& value) {
+        struct awaiter {
+            coro_fifo& q;
+            T value;
+            bool await_ready() const { return not q.full(); }
+            void await_suspend(std::coroutine_handle<> h) { q.producer = h; }
+            void await_resume() { q.put(std::move(value)); }
+        };
+        return awaiter{ *this, std::move(value) };
+    }
+
+    auto pop() {
+        struct awaiter {
+            coro_fifo& q;
+            bool await_ready() const { return not q.empty(); }
+            void await_suspend(std::coroutine_handle<> h) { q.consumer = h; }
+            T await_resume() { return q.take(); }
+        };
+        return awaiter{ *this };
+    }
+
+    bool empty() const {
+        return head == tail;
+    }
+
+    bool full() const {
+        return (tail + 1) % N == head;
+    }
+
+    void put(T&& value) {
+        data[tail] = std::move(value);
+        tail = (tail + 1) % N;
+        if (consumer)
+            scheduler.schedule(std::exchange(consumer, nullptr));
+    }
+
+    T take() {
+        T ret = std::move(data[head]);
+        head = (head + 1) % N;
+        if (producer)
+            scheduler.schedule(std::exchange(producer, nullptr));
+        return ret;
+    }
+
+private:
+    coro_scheduler& scheduler;
+    std::coroutine_handle<> producer;
+    std::coroutine_handle<> consumer;
+    std::array<T, N> data;
+    std::size_t head = 0;
+    std::size_t tail = 0;
+};
+
+// The default depth is much smaller than pipeline's: every lane gets to run as soon as its queue fills up,
+// so a short queue keeps the tokens in cache between producing and consuming them.
+template<class Stage, std::size_t Depth = 1024>
+class coro_pipeline {
+public:
+    using stage_t = Stage;
+    using input_t = typename Stage::input_t;
+    using output_t = typename Stage::output_t;
+
+    template<class Sink, class... Args>
+    coro_pipeline(const pipeline_config& config, Sink sink, const Args&... stage_args)
+        : own_stats(config.stats ? nullptr : std::make_unique<pipeline_stats>()),
+          stats(config.stats ? *config.stats : *own_stats),
+          input_counters(stats.add_thread(config.input_name)),
+          input_track(config.trace ? &config.trace->add_track(config.input_name) : nullptr),
+          sink(std::move(sink)) {
+        lanes.resize(config.width ? config.width : 1);
+        for (std::size_t i = 0; i < lanes.size(); i++) {
+            lanes[i] = std::make_unique<lane>(scheduler, stats, config.trace, config.stage_name + std::to_string(i),
+                                              stage_args...);
+            tasks.push_back(run_lane(*lanes[i]));
+        }
+        sink_counters = &stats.add_thread(config.sink_name);
+        sink_track = config.trace ? &config.trace->add_track(config.sink_name) : nullptr;
+        tasks.push_back(run_sink());
+        for (auto& t : tasks)
+            scheduler.schedule(t.handle);
+    }
+
+    ~coro_pipeline() {
+        if (group_open)
+            next();
+        for (auto& l : lanes)
+            put(*l, done_t{});
+        while (not tasks.back().handle.done())
+            scheduler.run_one();
+    }
+
+    coro_pipeline(const coro_pipeline&) = delete;
+    coro_pipeline& operator=(const coro_pipeline&) = delete;
+
+    void push(input_t&& token) {
+        put(*lanes[current], lane_input_t(std::in_place_index<0>, std::move(token)));
+        thread_counters::add(input_counters.tokens);
+        group_open = true;
+    }
+
+    void next() {
+        put(*lanes[current], group_end_t{});
+        thread_counters::add(input_counters.groups);
+        current = (current + 1) % lanes.size();
+        group_open = false;
+    }
+
+    std::size_t width() const {
+        return lanes.size();
+    }
+
+private:
+    struct group_end_t {};
+    struct done_t {};
+
+    using lane_input_t = std::variant<input_t, group_end_t, done_t>;
+    using lane_output_t = std::variant<output_t, done_t>;
+
+    struct lane {
+        template<class... Args>
+        lane(coro_scheduler& s, pipeline_stats& stats, tracer* trace, const std::string& name, const Args&... args)
+            : stage(args...), input(s), output(s),
+              counters(stats.add_thread(name)),
+              input_queue(stats.add_queue(name + ".in")),
+              output_queue(stats.add_queue(name + ".out")),
+              track(trace ? &trace->add_track(name) : nullptr) {}
+
+        Stage stage;
+        coro_fifo<lane_input_t, Depth> input;
+        coro_fifo<lane_output_t, Depth> output;
+        thread_counters& counters;
+        queue_counters& input_queue;
+        queue_counters& output_queue;
+        trace_track* track;
+    };
+
+    // The input stage is not a coroutine: when a lane is full, run the others until it has room again.
+    void put(lane& l, lane_input_t&& value) {
+        if (l.input.full()) {
+            trace_span span(input_track, "push wait", true);
+            while (l.input.full())
+                scheduler.run_one();
+        }
+        l.input.put(std::move(value));
+        thread_counters::add(l.input_queue.pushed);
+    }
+
+    // A lane's "format" spans are the stretches between being resumed and suspending again.
+    coro_task run_lane(lane& l) {
+        std::uint64_t run_begin = l.track ? trace_track::now() : 0;
+        auto suspending = [&](bool suspends) {
+            if (l.track and suspends)
+                l.track->record("format", run_begin, trace_track::now());
+        };
+        auto resumed = [&](bool suspended) {
+            if (l.track and suspended)
+                run_begin = trace_track::now();
+        };
+        for (;;) {
+            bool suspends = l.input.empty();
+            suspending(suspends);
+            lane_input_t value = co_await l.input.pop();
+            resumed(suspends);
+            thread_counters::add(l.input_queue.popped);
+            if (auto token = std::get_if<input_t>(&value)) {
+                l.stage(std::move(*token));
+                thread_counters::add(l.counters.tokens);
+            }
+            else if (std::holds_alternative<group_end_t>(value)) {
+                output_t result = l.stage.flush();
+                thread_counters::add(l.counters.bytes, output_size(result, 0));
+                suspends = l.output.full();
+                suspending(suspends);
+                co_await l.output.push(std::move(result));
+                resumed(suspends);
+                thread_counters::add(l.output_queue.pushed);
+                thread_counters::add(l.counters.groups);
+            }
+            else
+                break;
+        }
+        suspending(true);
+        co_await l.output.push(done_t{});
+    }
+
+    coro_task run_sink() {
+        for (std::size_t i = 0;; i = (i + 1) % lanes.size()) {
+            lane_output_t value = co_await lanes[i]->output.pop();
+            auto result = std::get_if<output_t>(&value);
+            if (not result)
+                break;
+            thread_counters::add(lanes[i]->output_queue.popped);
+            thread_counters::add(sink_counters->bytes, output_size(*result, 0));
+            {
+                trace_span span(sink_track, "write");
+                sink(std::move(*result));
+            }
+            thread_counters::add(sink_counters->groups);
+        }
+    }
+
+    coro_scheduler scheduler;
+    std::unique_ptr<pipeline_stats> own_stats;
+    pipeline_stats& stats;
+    thread_counters& input_counters;
+    trace_track* input_track;
+    thread_counters* sink_counters = nullptr;
+    trace_track* sink_track = nullptr;
+    std::function<void(output_t&&)> sink;
+    std::vector<std::unique_ptr<lane>> lanes;
+    std::vector<coro_task> tasks;
+    std::size_t current = 0;
+    bool group_open = false;
+};
+
+#endif /* CORO_PIPELINE_H_ */
@@ -0,0 +1,178 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "cache_aligned.h"
+
+// Epoch-based reclamation for lock-free structures. Readers pin the current epoch for as long as they hold
+// pointers into a structure (epoch_guard); writers retire what they have unlinked (epoch_retire) instead of
+// deleting it. The global epoch only advances when every pinned thread has seen the current one, so
+// anything retired in epoch e is unreachable for all threads once the epoch is e + 2, and is freed then.
+//
+// Every thread has a record, taken from a list shared by all threads on its first use and handed back when
+// it exits. Retired objects are freed by the thread that retired them: once it has retired a batch, or has
+// unpinned a batch of times since it last looked, or calls flush(). Whatever a thread leaves behind when it
+// exits is freed by the next thread that collects.
+class epoch_domain {
+public:
+    // The only domain: every thread has a single record, which belongs to this one.
+    static epoch_domain& global() {
+        static epoch_domain domain;
+        return domain;
+    }
+
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    // Pins may nest; only the outermost one counts.
+    void pin() {
+        record& r = local();
+        if (r.nesting++ == 0) {
+            std::uint64_t e = epoch.load(std::memory_order_seq_cst);
+            r.state.store(e << 1 | 1, std::memory_order_relaxed);
+            // Our state must be visible before we read any pointer of the structure.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void unpin() {
+        record& r = local();
+        if (--r.nesting == 0) {
+            r.state.store(0, std::memory_order_release);
+            if (not r.limbo.empty() and ++r.unpins >= collect_batch)
+                collect(r);
+        }
+    }
+
+    // Calls deleter(p) once no thread can still hold p, i.e. two epochs from now. The caller must already
+    // have made p unreachable for threads that pin from now on.
+    void retire(void* p, void (*deleter)(void*)) {
+        record& r = local();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        r.limbo.push_back({ epoch.load(std::memory_order_seq_cst), p, deleter });
+        if (r.limbo.size() >= collect_batch)
+            collect(r);
+    }
+
+    // Frees everything retired so far that no pinned thread can still hold, advancing the epoch as far as
+    // the pinned threads allow. For writers that retire rarely, which would otherwise wait for a batch.
+    void flush() {
+        try_advance();
+        collect(local());
+    }
+
+private:
+    struct retired {
+        std::uint64_t epoch;
+        void* p;
+        void (*deleter)(void*);
+    };
+
+    struct alignas(cache_line_size) record {
+        std::atomic<std::uint64_t> state{0};  // epoch << 1 | 1 while pinned, 0 otherwise
+        std::atomic<bool> in_use{true};
+        record* next = nullptr;
+        unsigned nesting = 0;                 // owned by the thread using the record, as are unpins and limbo
+        std::size_t unpins = 0;               // since the last collect
+        std::vector<retired> limbo;           // in the order retired, so epochs never decrease
+    };
+
+    epoch_domain() = default;
+
+    static constexpr std::size_t collect_batch = 64;
+
+    // The calling thread's record, claimed on its first call.
+    record& local() {
+        struct owner {
+            ~owner() {
+                if (r)
+                    r->in_use.store(false, std::memory_order_release);
+            }
+            record* r = nullptr;
+        };
+        thread_local owner o;
+        if (not o.r)
+            o.r = claim();
+        return *o.r;
+    }
+
+    record* claim() {
+        for (record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+            bool free = false;
+            if (not r->in_use.load(std::memory_order_relaxed)
+                    and r->in_use.compare_exchange_strong(free, true, std::memory_order_acquire))
+                return r;
+        }
+        record* r = new record;
+        r->next = records.load(std::memory_order_relaxed);
+        while (not records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        return r;
+    }
+
+    // Advances the global epoch if every pinned thread is in the current one.
+    void try_advance() {
+        std::uint64_t e = epoch.load(std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+            std::uint64_t state = r->state.load(std::memory_order_relaxed);
+            if ((state & 1) and (state >> 1) != e)
+                return;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        epoch.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+    }
+
+    // Moves what r retired at least two epochs before e to expired.
+    static void take_expired(record& r, std::uint64_t e, std::vector<retired>& expired) {
+        std::size_t n = 0;
+        while (n < r.limbo.size() and r.limbo[n].epoch + 2 <= e)
+            n++;
+        expired.insert(expired.end(), r.limbo.begin(), r.limbo.begin() + n);
+        r.limbo.erase(r.limbo.begin(), r.limbo.begin() + n);
+    }
+
+    // Frees what r, and the records of threads that have exited, retired at least two epochs ago. Deleters
+    // run here rather than in exiting threads, whose other thread_locals may be gone already. They may
+    // retire more, so they run on a list of their own.
+    void collect(record& r) {
+        try_advance();
+        std::uint64_t e = epoch.load(std::memory_order_seq_cst);
+        r.unpins = 0;
+        std::vector<retired> expired;
+        take_expired(r, e, expired);
+        for (record* o = records.load(std::memory_order_acquire); o; o = o->next) {
+            bool free = false;
+            if (o->in_use.load(std::memory_order_relaxed)
+                    or not o->in_use.compare_exchange_strong(free, true, std::memory_order_acquire))
+                continue;
+            take_expired(*o, e, expired);
+            o->in_use.store(false, std::memory_order_release);
+        }
+        for (const auto& x : expired)
+            x.deleter(x.p);
+    }
+
+    alignas(cache_line_size) std::atomic<std::uint64_t> epoch{0};
+    alignas(cache_line_size) std::atomic<record*> records{nullptr};
+};
+
+// Pins the calling thread to the current epoch for the guard's lifetime.
+class epoch_guard {
+public:
+    epoch_guard() { epoch_domain::global().pin(); }
+    ~epoch_guard() { epoch_domain::global().unpin(); }
+
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+};
+
+// Deletes p once no pinned thread can hold it any more.
+template<class T>
+void epoch_retire(T* p) {
+    epoch_domain::global().retire(p, [](void* q) { delete static_cast<T*>(q); });
+}
+
+#endif /* EPOCH_H_ */
@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <thread>
 #include <vector>
 #include <chrono>
+#include "cache_aligned.h"
 
 using namespace std::literals::chrono_literals;
 
@@ -11,7 +20,7 @@ struct data_t
 };
 std::array<data_t, 4> data;
 
-int main() {
+int demo() {
     volatile bool done = false;
 
     std::vector<std::thread> threads;
@@ -35,3 +44,97 @@ int main() {
 
     return 0;
 }
+
+// Every thread increments its own int, `stride` bytes after the previous thread's, for `duration`.
+// Returns the increments per second of all threads together.
+double increments_per_second(std::size_t threads, std::size_t stride, std::chrono::milliseconds duration) {
+    constexpr std::size_t page = 4096;
+    std::unique_ptr<char[]> buffer(new char[threads * stride + page]);
+    char* base = buffer.get() + (page - reinterpret_cast<std::uintptr_t>(buffer.get()) % page);
+    std::atomic<bool> go{false}, done{false};
+    std::vector<long> counts(threads);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < threads; i++)
+        workers.emplace_back([&, i] {
+            volatile int* x = new (base + i * stride) int(0);
+            while (not go.load(std::memory_order_acquire))
+                ;
+            while (not done.load(std::memory_order_relaxed))
+                ++*x;
+            counts[i] = *x;
+        });
+    auto t0 = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(duration);
+    done = true;
+    for (auto& t : workers)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    long total = 0;
+    for (long n : counts)
+        total += n;
+    return total / seconds;
+}
+
+// Table of increments/s by stride (rows) and thread count (columns). Throughput jumps once the stride reaches
+// the distance at which neighbours stop sharing a line (or an adjacent-line prefetch pair).
+int sweep(const std::vector<std::size_t>& thread_counts, std::chrono::milliseconds duration) {
+    std::cout << "cache_line_size " << cache_line_size << ", Mincrements/s by stride (bytes) and threads\n";
+    std::cout << "stride";
+    for (std::size_t n : thread_counts)
+        std::cout << "\t" << n;
+    std::cout << "\n";
+    for (std::size_t stride = sizeof(int); stride <= 256; stride *= 2) {
+        std::cout << stride;
+        for (std::size_t n : thread_counts)
+            std::cout << "\t" << increments_per_second(n, stride, duration) / 1e6 << std::flush;
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+int usage(int rc) {
+    std::cerr << "Usage: false-sharing [options]\n"
+              << "Without options, four threads increment adjacent ints for a second.\n"
+              << "  --sweep            Measure increments/s for strides of 4..256 bytes and several thread counts\n"
+              << "  -t|--threads n,... Thread counts of the sweep (default 1, 2, 4, ... up to the number of CPUs)\n"
+              << "  -d|--duration ms   Time per measurement (default 200)\n";
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    bool do_sweep = false;
+    std::vector<std::size_t> thread_counts;
+    std::chrono::milliseconds duration(200);
+    while (++argv, --argc) {
+        if (strcmp(*argv, "--sweep") == 0)
+            do_sweep = true;
+        else if (strcmp(*argv, "-t") == 0 or strcmp(*argv, "--threads") == 0) {
+            if (not (++argv, --argc))
+                return usage(1);
+            std::istringstream is(*argv);
+            for (std::size_t n; is >> n;) {
+                thread_counts.push_back(n);
+                is.ignore(1, ',');
+            }
+        }
+        else if (strcmp(*argv, "-d") == 0 or strcmp(*argv, "--duration") == 0) {
+            if (not (++argv, --argc))
+                return usage(1);
+            duration = std::chrono::milliseconds(atoi(*argv));
+        }
+        else if (strcmp(*argv, "-h") == 0 or strcmp(*argv, "--help") == 0)
+            return usage(0);
+        else
+            return usage(1);
+    }
+    if (not do_sweep)
+        return demo();
+    if (thread_counts.empty()) {
+        std::size_t cpus = std::max(2u, std::thread::hardware_concurrency());
+        for (std::size_t n = 1; n < cpus; n *= 2)
+            thread_counts.push_back(n);
+        thread_counts.push_back(cpus);
+    }
+    return sweep(thread_counts, duration);
+}
@@ -2,41 +2,40 @@
 #define __FIFO_H__
 
 #include <array>
+#include <atomic>
 #include <thread>
+#include "cache_aligned.h"
 
 using namespace std::literals::chrono_literals;
 
+// Single-producer single-consumer ring of N - 1 slots. The producer publishes a slot by storing tail with
+// release after writing it, the consumer hands it back by storing head with release after moving out of it;
+// each side reads the other's index with acquire, so the slot's contents are ordered with the index.
 template<typename T, std::size_t N = 65536>
 class fifo {
 public:
     void push(T&& value) {
-        while (full())
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t next = (t + 1) % N;
+        while (next == head.load(std::memory_order_acquire))
             std::this_thread::sleep_for(1us);
-        data[tail] = std::move(value);
-        tail = (tail + 1) % N;
+        data[t] = std::move(value);
+        tail.store(next, std::memory_order_release);
     }
 
     T pop() {
-        T ret;
-        while (empty())
+        std::size_t h = head.load(std::memory_order_relaxed);
+        while (h == tail.load(std::memory_order_acquire))
             std::this_thread::sleep_for(1us);
-        ret = std::move(data[head]);
-        head = (head + 1) % N;
+        T ret = std::move(data[h]);
+        head.store((h + 1) % N, std::memory_order_release);
         return ret;
     }
 
 private:
-    bool empty() const {
-        return head == tail;
-    }
-
-    bool full() const {
-        return (tail + 1) % N == head;
-    }
-
     std::array<T, N> data;
-    std::size_t head = 0;
-    std::size_t tail = 0;
+    alignas(cache_line_size) std::atomic<std::size_t> head{0};  // written by the consumer only
+    alignas(cache_line_size) std::atomic<std::size_t> tail{0};  // written by the producer only
 };
 
 #endif /* __FIFO_H__ */
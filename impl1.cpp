@@ -1,7 +1,16 @@
+#include "arena.h"
 #include <iostream>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
 #include <nlohmann/json.hpp>
 
-using json = nlohmann::json;
+// The whole DOM lives in s_arena: parsing makes millions of small allocations that are only
+// ever released at exit, so a bump allocator is all we need.
+using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+using json = nlohmann::basic_json<std::map, std::vector, arena_string, bool, std::int64_t, std::uint64_t, double,
+                                  arena_allocator>;
 
 struct indent { std::size_t level; };
 std::ostream& operator<<(std::ostream& os, indent value) {
@@ -20,7 +29,7 @@ std::ostream& operator<<(std::ostream& os, json_as_xml doc) {
 
         // Define vector of threads here
 
-        for (const auto& [key, val] : doc.j.items()) {
+        for (const auto& val : doc.j) {
             // Create thread that runs the following statement here. Store thread in vector.
             os << "\n" << indent{ doc.level + 1 } << "<item>" << json_as_xml{ val, doc.level + 1 } << "</item>";
         }
@@ -30,14 +39,14 @@ std::ostream& operator<<(std::ostream& os, json_as_xml doc) {
         return os << "\n" << indent{ doc.level };
     }
     case json::value_t::object:
-        for (const auto& [key, val] : doc.j.items()) {
+        for (const auto& [key, val] : doc.j.get_ref<const json::object_t&>()) {
             os << "\n" << indent{ doc.level + 1 } << "<" << key << ">" << json_as_xml{ val, doc.level + 1 } << "</"
                << key << ">";
         }
         return os << "\n" << indent{ doc.level };
 
     case json::value_t::string:
-        for (char c : doc.j.get<std::string>()) {
+        for (char c : doc.j.get_ref<const json::string_t&>()) {
             switch (c) {
             case '<': os << "&lt;" ; break;
             case '>': os << "&gt;" ; break;
@@ -67,8 +76,12 @@ std::ostream& operator<<(std::ostream& os, json_as_xml doc) {
     }
 }
 
-int main() {
-    json doc;
+int main(int argc, const char** argv) {
+    if (argc > 1 and not std::strcmp(argv[1], "--huge-pages"))
+        s_arena.use_huge_pages(true);
+
+    // Intentionally leaked: tearing down the DOM node by node is pure overhead right before exit.
+    json& doc = *new json;
     std::cin >> doc;
     std::cout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" << "<doc>" << json_as_xml{ doc } << "</doc>\n";
     return 0;
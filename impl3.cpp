@@ -1,168 +1,50 @@
-#include "fifo.h"
+#include "pipeline.h"
+#ifdef HAVE_COROUTINES
+#include "coro_pipeline.h"
+#endif
+#include "sax_record.h"
+#include "stats.h"
+#include "trace.h"
+#include "xml_format.h"
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <fstream>
+#include <optional>
 #include <variant>
 #include <nlohmann/json.hpp>
 #include <thread>
 #include <vector>
 #include <sys/prctl.h>
-#include <sstream>
 
 using json = nlohmann::json;
 
-struct indent { std::size_t level; };
-std::ostream& operator<<(std::ostream& os, indent value) {
-    while (value.level--)
-        os << "    ";
-    return os;
-}
-
+template<class Pipeline>
 struct json_as_xml : nlohmann::json_sax<json> {
-    struct begin_group_t {};
-    struct end_group_t {};
-    struct key_t { std::string s; };
-    struct done_t {};
-
-    using input_t = std::variant<const char*,
-                                 number_integer_t,
-                                 number_unsigned_t,
-                                 number_float_t,
-                                 string_t,
-                                 begin_group_t,
-                                 end_group_t,
-                                 key_t,
-                                 done_t>;
-
-    using output_t = std::variant<std::string, done_t>;
-
-    struct formatter {
-        std::vector<std::string> stack = { "" };
-        std::thread thread;
-        fifo<input_t> input;
-        fifo<output_t> output;
-        std::ostringstream os;
-        bool formatter_done = false;
-        bool writer_done = false;
-
-        formatter() {
-            thread = std::thread([this] {
-                prctl(PR_SET_NAME, "formatter", nullptr, nullptr, nullptr);
-                while (not formatter_done)
-                    dump(input.pop());
-            });
-        }
-
-        ~formatter() {
-            thread.join();
-        }
-
-        const char* current_tag() const {
-            if (stack.back().empty()) return "item";
-            else                      return stack.back().c_str();
-        }
-
-        template<class T>
-        void dump(T&& value) {
-            os << indent{ stack.size() }<< "<" << current_tag() << ">" << value << "</" << current_tag() << ">\n";
-        }
-
-        void dump(string_t&& value) {
-            os << indent{ stack.size() } << "<" << current_tag() << ">";
-            for (char c : value)
-            {
-                switch (c)
-                {
-                case '<': os << "&lt;" ; break;
-                case '>': os << "&gt;" ; break;
-                case '&': os << "&amp;"; break;
-                default:
-                    os << c;
-                    break;
-                }
-            }
-            os << "</" << current_tag() << ">\n";
-        }
-
-        void dump(begin_group_t&&) {
-            os << indent{ stack.size() } << "<" << current_tag() << ">\n";
-            stack.emplace_back();
-        }
-
-        void dump(end_group_t&&) {
-            stack.pop_back();
-            os << indent{ stack.size() } << "</" << current_tag() << ">\n";
-            if (stack.size() == 1) {
-                output.push(os.str());
-                os.str("");
-            }
-        }
-
-        void dump(key_t&& value) {
-            stack.back() = std::move(value.s);
-        }
-
-        void dump(done_t&&) {
-            formatter_done = true;
-            output.push(done_t{});
-        }
-
-        void dump(input_t&& value) {
-            std::visit([&](auto&& arg) {
-                dump(std::move(arg));
-            }, std::move(value));
-        }
-    };
-    std::vector<std::unique_ptr<formatter>> formatters;
-    std::thread writer;
-
-    json_as_xml() {
-        formatters.resize(2);
-        for (auto& f : formatters)
-            f = std::make_unique<formatter>();
-
-        writer = std::thread([this] {
-            prctl(PR_SET_NAME, "writer", nullptr, nullptr, nullptr);
-            while (not std::all_of(formatters.begin(), formatters.end(),
-                    [&](const std::unique_ptr<formatter>& f) {return f->writer_done;})) {
-                for (auto& f : formatters) {
-                    if (f->writer_done)
-                        continue;
-                    dump(*f, f->output.pop());
-                }
-            }
-        });
-        std::cout << "<doc>\n";
-    }
-
-    ~json_as_xml() {
-        for (auto& f : formatters)
-            f->input.push(done_t {}); // signal that parsing is done;
-        writer.join();
-        std::cout << "</doc>\n";
-    }
-
-    void dump(formatter&, std::string&& s) {
-        std::cout << s;
-    }
+    using begin_group_t = xml_events::begin_group_t;
+    using end_group_t = xml_events::end_group_t;
+    using key_t = xml_events::key_t;
+    using lexeme_t = xml_events::lexeme_t;
+    using input_t = xml_events::input_t;
 
-    void dump(formatter& f, done_t&&) {
-        f.writer_done = true;
-    }
+    Pipeline formatters;
 
-    void dump(formatter& f, output_t&& value) {
-        std::visit([&](auto&& arg) {dump(f, std::move(arg));}, std::move(value));
-    }
+    explicit json_as_xml(const pipeline_config& config)
+        : formatters(config, [](std::string&& s) { std::cout << s; }) {}
 
-    unsigned int formatter_index = 0;
     unsigned int stack_depth = 0;
 
+    // Every top-level item is a group of its own, formatted as a whole by one of the formatters.
     bool post(input_t&& value) {
-        formatters[formatter_index]->input.push(std::move(value));
+        formatters.push(std::move(value));
+        if (stack_depth == 1)
+            formatters.next();
         return true;
     }
 
     bool begin_group() {
         if (stack_depth > 0)
-            post(begin_group_t {});
+            formatters.push(begin_group_t {});
         stack_depth++;
         return true;
     }
@@ -171,8 +53,6 @@ struct json_as_xml : nlohmann::json_sax<json> {
         stack_depth--;
         if (stack_depth > 0)
             post(end_group_t {});
-        if (stack_depth == 1)
-            formatter_index = (formatter_index + 1) % formatters.size();
         return true;
     }
 
@@ -180,7 +60,12 @@ struct json_as_xml : nlohmann::json_sax<json> {
     bool boolean(bool val)                                 { return post(val ? "true" : "false"); }
     bool number_integer(number_integer_t val)              { return post(val); }
     bool number_unsigned(number_unsigned_t val)            { return post(val); }
-    bool number_float(number_float_t val, const string_t&) { return post(val); }
+    bool number_float(number_float_t val, const string_t& lexeme) {
+        if constexpr (Pipeline::stage_t::wants_lexemes)
+            return post(lexeme_t{ lexeme });
+        else
+            return post(val);
+    }
     bool string(string_t& val)                             { return post(std::move(val)); }
     bool binary(binary_t&)                                 { return true; }
 
@@ -189,18 +74,188 @@ struct json_as_xml : nlohmann::json_sax<json> {
     bool start_array(std::size_t)  { return begin_group(); }
     bool end_array()               { return end_group(); }
 
-    bool key(string_t& val) { return post(key_t{std::move(val)}); }
+    bool key(string_t& val) { formatters.push(key_t{std::move(val)}); return true; }
 
     bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {return true;}
 };
 
-int main() {
-    prctl(PR_SET_NAME, "parser", nullptr, nullptr, nullptr);
-    std::ios::sync_with_stdio(false);
-    std::cout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-    {
-        json_as_xml doc;
+struct options {
+    std::size_t width = 2;
+    bool replay = false;
+    bool coro = false;
+    bool pin = false;
+    bool numa_local = false;
+    bool stats = false;
+    bool stats_json = false;
+    const char* trace_file = nullptr;
+};
+
+template<class Pipeline>
+bool convert(const options& opts) {
+    pipeline_stats stats;
+    std::optional<stats_monitor> monitor;
+    if (opts.stats)
+        monitor.emplace(stats, std::cerr, opts.stats_json);
+
+    std::optional<tracer> trace;
+    if (opts.trace_file)
+        trace.emplace();
+
+    pipeline_config config;
+    config.width = opts.width;
+    config.input_name = "parser";
+    config.stage_name = "formatter";
+    config.sink_name = "writer";
+    config.stats = &stats;
+    config.trace = trace ? &*trace : nullptr;
+    if (opts.pin) {
+        // Parser and writer each get a physical core of their own, the formatters are spread over the rest.
+        std::vector<int> cpus = spread_cpus();
+        if (not cpus.empty()) {
+            pin_this_thread(cpus[0]);
+            config.sink_cpu = cpus[1 % cpus.size()];
+            for (std::size_t i = 0; i < opts.width; i++)
+                config.stage_cpus.push_back(cpus[(i + 2) % cpus.size()]);
+            config.local_queues = opts.numa_local;
+        }
+    }
+
+    bool ok = true;
+    if (opts.replay) {
+        sax_recording recording(STDIN_FILENO);
+        json_as_xml<Pipeline> doc(config);
+        ok = sax_replay(recording.begin(), recording.end(), &doc);
+    }
+    else {
+        json_as_xml<Pipeline> doc(config);
         json::sax_parse(std::cin, &doc);
     }
-    return 0;
+
+    if (trace) {
+        std::ofstream os(opts.trace_file);
+        trace->write_json(os);
+    }
+    return ok;
+}
+
+// The output formats, each a converter instantiated for its policy, picked by name at startup.
+struct output_format {
+    const char* name;
+    const char* numbers;
+    bool (*threads)(const options&);
+    bool (*coro)(const options&);
+};
+
+template<class Layout, float_style Floats>
+constexpr output_format make_output_format(const char* name, const char* numbers) {
+    using policy = with_floats<Layout, Floats>;
+#ifdef HAVE_COROUTINES
+    return { name, numbers, &convert<pipeline<xml_formatter<policy>>>, &convert<coro_pipeline<xml_formatter<policy>>> };
+#else
+    return { name, numbers, &convert<pipeline<xml_formatter<policy>>>, nullptr };
+#endif
+}
+
+constexpr output_format output_formats[] = {
+    make_output_format<pretty_xml, float_style::general>("pretty", "general"),
+    make_output_format<pretty_xml, float_style::shortest>("pretty", "shortest"),
+    make_output_format<pretty_xml, float_style::lexeme>("pretty", "lexeme"),
+    make_output_format<compact_xml, float_style::general>("compact", "general"),
+    make_output_format<compact_xml, float_style::shortest>("compact", "shortest"),
+    make_output_format<compact_xml, float_style::lexeme>("compact", "lexeme"),
+};
+
+int main(int argc, const char** argv) {
+    const char* prog_name = argv[0];
+    auto usage = [&](int ret) {
+        std::cerr << "Usage: " << prog_name << " [option*] <input >output\n"
+                << "Options are:\n"
+                << "  -h|--help       Display this help message\n"
+                << "  -w|--width      Number of formatters (default 2)\n"
+                << "  -m|--mode       threads: a thread per formatter and one for the writer\n"
+                << "                  coro:    formatters and writer are coroutines on the parser thread\n"
+                << "                  Defaults to coro on hosts with at most 2 cores\n"
+                << "  -p|--pin        Pin parser, writer and formatters to separate physical cores\n"
+                << "  --numa-local    With --pin: allocate each formatter's queues on its own NUMA node\n"
+                << "  --stats[=json]  Report per-thread counters on stderr at exit and on SIGUSR1\n"
+                << "  --trace file    Write a Chrome trace event timeline of all threads to file\n"
+                << "  -f|--format     pretty:  one element per line, indented (default)\n"
+                << "                  compact: no whitespace between elements\n"
+                << "  -n|--numbers    general:  floats with 6 significant digits, like printf's %g (default)\n"
+                << "                  shortest: the shortest text that reads back as the same double\n"
+                << "                  lexeme:   floats exactly as written in the input\n"
+                << "  --replay        Input is a sax-record recording instead of JSON\n";
+        return ret;
+    };
+    options opts;
+    const char* format = "pretty";
+    const char* numbers = "general";
+#ifdef HAVE_COROUTINES
+    opts.coro = std::thread::hardware_concurrency() <= 2;
+#endif
+    while (++argv, --argc)
+    {
+        if (not std::strcmp(argv[0], "-h") or not std::strcmp(argv[0], "--help"))
+            return usage(0);
+        else if (not std::strcmp(argv[0], "-w") or not std::strcmp(argv[0], "--width"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            int width = std::atoi(argv[0]);
+            if (width < 1) return usage(1);
+            opts.width = width;
+        }
+        else if (not std::strcmp(argv[0], "-m") or not std::strcmp(argv[0], "--mode"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            if (not std::strcmp(argv[0], "threads"))
+                opts.coro = false;
+#ifdef HAVE_COROUTINES
+            else if (not std::strcmp(argv[0], "coro"))
+                opts.coro = true;
+#endif
+            else
+                return usage(1);
+        }
+        else if (not std::strcmp(argv[0], "-p") or not std::strcmp(argv[0], "--pin"))
+            opts.pin = true;
+        else if (not std::strcmp(argv[0], "--numa-local"))
+            opts.numa_local = true;
+        else if (not std::strcmp(argv[0], "--stats"))
+            opts.stats = true;
+        else if (not std::strcmp(argv[0], "--stats=json"))
+            opts.stats = opts.stats_json = true;
+        else if (not std::strcmp(argv[0], "--trace"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            opts.trace_file = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "-f") or not std::strcmp(argv[0], "--format"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            format = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "-n") or not std::strcmp(argv[0], "--numbers"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            numbers = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--replay"))
+            opts.replay = true;
+        else
+            return usage(1);
+    }
+    auto converter = std::find_if(std::begin(output_formats), std::end(output_formats), [&](const output_format& f) {
+        return not std::strcmp(f.name, format) and not std::strcmp(f.numbers, numbers);
+    });
+    if (converter == std::end(output_formats))
+        return usage(1);
+
+    prctl(PR_SET_NAME, "parser", nullptr, nullptr, nullptr);
+    std::ios::sync_with_stdio(false);
+    std::cout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" << "<doc>\n";
+    bool ok = opts.coro ? converter->coro(opts) : converter->threads(opts);
+    std::cout << "</doc>\n";
+    if (not ok)
+        std::cerr << prog_name << ": malformed recording\n";
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,58 @@
+#ifndef LAZY_H_
+#define LAZY_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+
+// A T constructed on first use, by whichever thread gets there first, from the arguments given to the lazy.
+// Once it exists, get() is a single acquire load; until then, callers take a mutex and the first one
+// constructs the T while the others wait. If the constructor throws, the exception propagates to that caller
+// and the next get() tries again.
+template<class T>
+class lazy {
+public:
+    template<class... Args>
+    explicit lazy(Args... args)
+        : construct([args = std::make_tuple(std::move(args)...)](void* where) {
+              return std::apply([where](const auto&... a) { return new (where) T(a...); }, args);
+          }) {}
+
+    lazy(const lazy&) = delete;
+    lazy& operator=(const lazy&) = delete;
+
+    ~lazy() {
+        if (T* p = instance.load(std::memory_order_relaxed))
+            p->~T();
+    }
+
+    T& get() {
+        if (T* p = instance.load(std::memory_order_acquire))
+            return *p;
+        return initialise();
+    }
+
+    T& operator*() { return get(); }
+    T* operator->() { return &get(); }
+
+private:
+    [[gnu::noinline, gnu::cold]] T& initialise() {
+        std::lock_guard<std::mutex> lock(mtx);
+        T* p = instance.load(std::memory_order_relaxed);
+        if (not p) {
+            p = construct(&storage);
+            instance.store(p, std::memory_order_release);
+        }
+        return *p;
+    }
+
+    std::atomic<T*> instance{nullptr};
+    std::function<T*(void*)> construct;
+    std::mutex mtx;
+    alignas(T) unsigned char storage[sizeof(T)];
+};
+
+#endif /* LAZY_H_ */
@@ -0,0 +1,222 @@
+#ifndef LOCKS_H_
+#define LOCKS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "cache_aligned.h"
+
+// Alternatives to std::mutex, all Lockable (lock, try_lock, unlock), so they work with std::lock_guard,
+// std::unique_lock and std::scoped_lock.
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+// Exponential backoff for spin loops. Past the cap it yields the CPU on every call instead: with more threads
+// than cores, whoever we're waiting for may not be running at all.
+class backoff {
+public:
+    void operator()() {
+        if (spins > max_spins) {
+            std::this_thread::yield();
+            return;
+        }
+        for (unsigned i = 0; i < spins; i++)
+            cpu_relax();
+        spins *= 2;
+    }
+
+private:
+    static constexpr unsigned max_spins = 64;
+    unsigned spins = 1;
+};
+
+// Test-and-test-and-set: waiters spin on a plain load, which stays in their cache until the owner releases,
+// and only then try the exchange.
+class ttas_spinlock {
+public:
+    void lock() {
+        backoff wait;
+        while (locked.exchange(true, std::memory_order_acquire))
+            while (locked.load(std::memory_order_relaxed))
+                wait();
+    }
+
+    bool try_lock() {
+        return not locked.load(std::memory_order_relaxed) and not locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked{false};
+};
+
+// FIFO spinlock: take a number and wait until it is served. Fair, but every waiter still spins on the same line.
+class ticket_lock {
+public:
+    void lock() {
+        std::uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+        backoff wait;
+        while (serving.load(std::memory_order_acquire) != ticket)
+            wait();
+    }
+
+    bool try_lock() {
+        std::uint32_t s = serving.load(std::memory_order_relaxed);
+        std::uint32_t expected = s;
+        return next.compare_exchange_strong(expected, s + 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<std::uint32_t> next{0};
+    std::atomic<std::uint32_t> serving{0};
+};
+
+// MCS queue lock: every waiter spins on a flag in its own queue node, and the owner hands the lock to its
+// successor directly, so a release touches one other cache line however many threads wait.
+// Lockable has no room for the node, so nodes come from a per-thread free list, and the owner's node is kept
+// in the lock for unlock() to find.
+class mcs_lock {
+public:
+    void lock() {
+        node* n = node_pool::get();
+        n->next.store(nullptr, std::memory_order_relaxed);
+        n->locked.store(true, std::memory_order_relaxed);
+        if (node* prev = tail.exchange(n, std::memory_order_acq_rel)) {
+            prev->next.store(n, std::memory_order_release);
+            backoff wait;
+            while (n->locked.load(std::memory_order_acquire))
+                wait();
+        }
+        owner = n;
+    }
+
+    bool try_lock() {
+        node* n = node_pool::get();
+        n->next.store(nullptr, std::memory_order_relaxed);
+        node* expected = nullptr;
+        if (not tail.compare_exchange_strong(expected, n, std::memory_order_acquire, std::memory_order_relaxed)) {
+            node_pool::put(n);
+            return false;
+        }
+        owner = n;
+        return true;
+    }
+
+    void unlock() {
+        node* n = owner;
+        node* succ = n->next.load(std::memory_order_acquire);
+        if (not succ) {
+            node* expected = n;
+            if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed)) {
+                node_pool::put(n);
+                return;
+            }
+            // A successor has swapped itself in but not linked itself yet.
+            while (not (succ = n->next.load(std::memory_order_acquire)))
+                cpu_relax();
+        }
+        succ->locked.store(false, std::memory_order_release);
+        node_pool::put(n);
+    }
+
+private:
+    struct alignas(cache_line_size) node {
+        std::atomic<node*> next{nullptr};
+        std::atomic<bool> locked{false};
+    };
+
+    // Nodes are owned by the thread that allocated them and deleted when it exits; a thread holding k MCS locks
+    // at once uses k nodes.
+    struct node_pool {
+        ~node_pool() {
+            for (node* n : free)
+                delete n;
+        }
+
+        static node* get() {
+            auto& pool = instance();
+            if (pool.free.empty())
+                return new node;
+            node* n = pool.free.back();
+            pool.free.pop_back();
+            return n;
+        }
+
+        static void put(node* n) {
+            instance().free.push_back(n);
+        }
+
+        static node_pool& instance() {
+            thread_local node_pool pool;
+            return pool;
+        }
+
+        std::vector<node*> free;
+    };
+
+    std::atomic<node*> tail{nullptr};
+    node* owner = nullptr;  // only accessed by the thread holding the lock
+};
+
+// Sleeping mutex on a futex (Drepper, "Futexes Are Tricky", mutex #3): 0 unlocked, 1 locked, 2 locked and maybe
+// contended. Uncontended lock and unlock are one atomic instruction each, without system calls; waiters spin
+// briefly before sleeping.
+class futex_mutex {
+public:
+    void lock() {
+        int c = 0;
+        if (state.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+        for (int i = 0; i < 100; i++) {
+            cpu_relax();
+            c = 0;
+            if (state.load(std::memory_order_relaxed) == 0
+                    and state.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+        if (c != 2)
+            c = state.exchange(2, std::memory_order_acquire);
+        while (c != 0) {
+            futex(FUTEX_WAIT_PRIVATE, 2);
+            c = state.exchange(2, std::memory_order_acquire);
+        }
+    }
+
+    bool try_lock() {
+        int c = 0;
+        return state.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        if (state.exchange(0, std::memory_order_release) == 2)
+            futex(FUTEX_WAKE_PRIVATE, 1);
+    }
+
+private:
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+
+    void futex(int op, int value) {
+        syscall(SYS_futex, reinterpret_cast<int*>(&state), op, value, nullptr, nullptr, 0);
+    }
+
+    std::atomic<int> state{0};
+};
+
+#endif /* LOCKS_H_ */
@@ -1,17 +1,290 @@
+#include "pipeline.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using json = nlohmann::json;
 
-int main(int, const char** argv) {
-    int r = std::atoi(argv[1]);
+// Two ways to make benchmark input:
+//   make-large-file r <seed.json      the elements of seed.json repeated r times
+//   make-large-file --records N ...   N synthetic records, generated in parallel
+// Synthetic records are generated in chunks of a fixed number of records, every chunk from its own random engine
+// seeded with (seed, chunk index), so the output only depends on the parameters, not on the number of threads.
+
+struct generator_params {
+    std::uint64_t records = 100000;
+    std::uint64_t chunk_records = 1000;
+    std::uint64_t seed = 1;
+    int depth = 3;               // nesting levels, including the record itself
+    double fields = 8;           // average number of fields of a record; nested objects have half their parent's
+    double string_length = 12;   // mean of the geometric string length distribution
+    double escape_density = 0.02;// probability that a string character is one that must be escaped in JSON or XML
+    std::size_t keys = 64;       // key cardinality
+    double size_skew = 0;        // Pareto shape of the per-record size multiplier, smaller is more skewed; 0: off
+};
+
+// splitmix64: decorrelates the seeds of neighbouring chunks.
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// The splitmix64 generator: much cheaper than mt19937_64 to run and to seed, which happens once per chunk.
+struct splitmix64 {
+    using result_type = std::uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    void seed(std::uint64_t s) { state = s; }
+    result_type operator()() { return mix(state += 0x9e3779b97f4a7c15ull); }
+
+    std::uint64_t state = 0;
+};
+
+// Key names, sorted, so that objects can list their keys in the order std::map (impl1) iterates them.
+std::vector<std::string> make_keys(const generator_params& params) {
+    splitmix64 rng{ params.seed };
+    std::vector<std::string> keys;
+    for (std::size_t i = 0; keys.size() < std::max<std::size_t>(params.keys, 1); i++) {
+        std::string key(3 + rng() % 8, ' ');
+        for (auto& c : key)
+            c = 'a' + rng() % 26;
+        keys.push_back(key + "_" + std::to_string(i));
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+class chunk_generator {
+public:
+    using input_t = std::uint64_t; // chunk index
+    using output_t = std::string;
+
+    chunk_generator(const generator_params& params, const std::vector<std::string>& keys)
+        : params(params), keys(keys), escape_threshold(params.escape_density * 0x10000) {}
+
+    void operator()(std::uint64_t chunk) {
+        rng.seed(mix(params.seed ^ mix(chunk)));
+        std::uint64_t first = chunk * params.chunk_records;
+        std::uint64_t last = std::min(first + params.chunk_records, params.records);
+        for (std::uint64_t i = first; i < last; i++) {
+            if (i)
+                out += ',';
+            double size = params.fields;
+            if (params.size_skew > 0)
+                size *= std::min(1000.0, std::pow(1 - uniform(rng), -1 / params.size_skew));
+            object(size, params.depth);
+        }
+    }
+
+    std::string flush() {
+        std::string ret;
+        std::swap(ret, out);
+        return ret;
+    }
+
+private:
+    std::size_t count(double mean) {
+        return mean <= 0 ? 0 : std::geometric_distribution<std::size_t>(1 / (mean + 1))(rng);
+    }
+
+    void object(double fields, int depth) {
+        std::size_t n = std::min<std::size_t>(std::max<std::size_t>(1, count(fields)), keys.size());
+        // Pick n distinct keys (Floyd's algorithm) and list them in ascending order. Nested objects push their
+        // choice on top of this one's, and pop it again.
+        std::size_t base = picked.size();
+        for (std::size_t j = keys.size() - n; j < keys.size(); j++) {
+            std::size_t k = rng() % (j + 1);
+            picked.push_back(std::find(picked.begin() + base, picked.end(), k) == picked.end() ? k : j);
+        }
+        std::sort(picked.begin() + base, picked.end());
+        out += '{';
+        for (std::size_t i = 0; i < n; i++) {
+            if (i)
+                out += ',';
+            out += '"';
+            out += keys[picked[base + i]];
+            out += "\":";
+            value(fields / 2, depth - 1);
+        }
+        picked.resize(base);
+        out += '}';
+    }
+
+    void array(double fields, int depth) {
+        std::size_t n = count(fields);
+        out += '[';
+        for (std::size_t i = 0; i < n; i++) {
+            if (i)
+                out += ',';
+            value(fields / 2, depth - 1);
+        }
+        out += ']';
+    }
+
+    void value(double fields, int depth) {
+        char buf[32];
+        switch (rng() % (depth > 0 ? 8 : 6)) {
+            case 0: case 1:
+                string();
+                break;
+            case 2: {
+                std::int64_t i = rng();
+                out += std::to_string(i >> (rng() % 64));
+                break;
+            }
+            case 3: {
+                double mantissa = uniform(rng) - 0.5;
+                std::snprintf(buf, sizeof(buf), "%.6g", mantissa * std::pow(10.0, int(rng() % 13) - 6));
+                out += buf;
+                break;
+            }
+            case 4:
+                out += rng() % 2 ? "true" : "false";
+                break;
+            case 5:
+                out += "null";
+                break;
+            case 6:
+                object(fields, depth);
+                break;
+            case 7:
+                array(fields, depth);
+                break;
+        }
+    }
+
+    void string() {
+        static const char* escaped[] = { "\\\"", "\\\\", "\\n", "\\r", "\\t", "\\/", "&", "<", ">", "'" };
+        std::size_t n = count(params.string_length);
+        out += '"';
+        for (std::size_t i = 0; i < n; i++) {
+            std::uint64_t r = rng(); // one draw per character: 16 bits for the escape decision, 32 for the character
+            if ((r & 0xffff) < escape_threshold)
+                out += escaped[(r >> 16) % std::size(escaped)];
+            else
+                out += "abcdefghijklmnopqrstuvwxyz0123456789 _-."[(r >> 32) % 40];
+        }
+        out += '"';
+    }
+
+    const generator_params& params;
+    const std::vector<std::string>& keys;
+    std::uint64_t escape_threshold;
+    splitmix64 rng;
+    std::vector<std::size_t> picked;
+    std::uniform_real_distribution<double> uniform;
+    std::string out;
+};
+
+void generate(const generator_params& params, std::size_t threads) {
+    std::vector<std::string> keys = make_keys(params);
+    std::fputs("[", stdout);
+    {
+        pipeline_config config;
+        config.width = threads;
+        config.input_name = "main";
+        config.stage_name = "generator";
+        config.sink_name = "writer";
+        pipeline<chunk_generator, 4> chunks(config, [](std::string&& s) {
+            std::fwrite(s.data(), 1, s.size(), stdout);
+        }, params, keys);
+        for (std::uint64_t i = 0; i * params.chunk_records < params.records; i++) {
+            chunks.push(std::uint64_t(i));
+            chunks.next();
+        }
+    }
+    std::fputs("]", stdout);
+}
+
+// Serialise the seed's elements once and write that r times.
+void replicate(int r) {
     json doc;
     std::cin >> doc;
-    int counter = 0;
-    std::cout << "[";
-    for (int i = 0; i < r; i++)
-        for (const auto& e : doc)
-            std::cout << (counter++ == 0 ? "" : ",") << e;
-    std::cout << "]";
+    std::string elements;
+    for (const auto& e : doc)
+        elements += (elements.empty() ? "" : ",") + e.dump();
+    std::fputs("[", stdout);
+    for (int i = 0; i < r; i++) {
+        if (i and not elements.empty())
+            std::fputs(",", stdout);
+        std::fwrite(elements.data(), 1, elements.size(), stdout);
+    }
+    std::fputs("]", stdout);
+}
+
+int main(int argc, const char** argv) {
+    const char* prog_name = argv[0];
+    auto usage = [&](int ret) {
+        std::cerr << "Usage: " << prog_name << " r <seed.json >output.json\n"
+                << "       " << prog_name << " --records N [option*] >output.json\n"
+                << "Options are:\n"
+                << "  -h|--help            Display this help message\n"
+                << "  -j|--threads N       Number of generator threads (default: number of cores)\n"
+                << "  --records N          Number of records (default 100000)\n"
+                << "  --chunk-records N    Records per chunk (default 1000); changes the output\n"
+                << "  --seed N             Random seed (default 1)\n"
+                << "  --depth N            Nesting levels, including the record (default 3)\n"
+                << "  --fields X           Average number of fields per record (default 8)\n"
+                << "  --string-length X    Mean string length, geometrically distributed (default 12)\n"
+                << "  --escape-density X   Fraction of string characters that need escaping (default 0.02)\n"
+                << "  --keys N             Number of distinct keys (default 64)\n"
+                << "  --size-skew X        Pareto shape of the record size multiplier, 0 for none (default 0)\n";
+        return ret;
+    };
+    if (argc == 2 and argv[1][0] != '-') {
+        replicate(std::atoi(argv[1]));
+        return 0;
+    }
+
+    generator_params params;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    while (++argv, --argc)
+    {
+        auto number = [&](auto& value) {
+            if (not (++argv, --argc))
+                return false;
+            std::istringstream is(argv[0]);
+            return bool(is >> value);
+        };
+        bool ok = true;
+        if (not std::strcmp(argv[0], "-h") or not std::strcmp(argv[0], "--help"))
+            return usage(0);
+        else if (not std::strcmp(argv[0], "-j") or not std::strcmp(argv[0], "--threads"))
+            ok = number(threads);
+        else if (not std::strcmp(argv[0], "--records"))
+            ok = number(params.records);
+        else if (not std::strcmp(argv[0], "--chunk-records"))
+            ok = number(params.chunk_records) and params.chunk_records;
+        else if (not std::strcmp(argv[0], "--seed"))
+            ok = number(params.seed);
+        else if (not std::strcmp(argv[0], "--depth"))
+            ok = number(params.depth);
+        else if (not std::strcmp(argv[0], "--fields"))
+            ok = number(params.fields);
+        else if (not std::strcmp(argv[0], "--string-length"))
+            ok = number(params.string_length);
+        else if (not std::strcmp(argv[0], "--escape-density"))
+            ok = number(params.escape_density);
+        else if (not std::strcmp(argv[0], "--keys"))
+            ok = number(params.keys);
+        else if (not std::strcmp(argv[0], "--size-skew"))
+            ok = number(params.size_skew);
+        else
+            ok = false;
+        if (not ok)
+            return usage(1);
+    }
+    generate(params, threads);
     return 0;
 }
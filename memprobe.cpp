@@ -0,0 +1,205 @@
+#include "test_main.h"
+#include "cache_aligned.h"
+#include "locks.h"
+#include "topology.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Properties of the memory hierarchy that the false sharing, fifo and atomics results depend on: load latency
+// by working set size (which shows the cache sizes), access cost by stride (which shows the line size),
+// streaming bandwidth by thread count and the latency of handing a cache line from one core to another.
+
+named_option s_max_size_mb("max-size-mb", "Largest working set of the latency test, in MB", 256);
+named_option s_loads("loads", "Dependent loads per working set size of the latency test", 1 << 22);
+named_option s_bandwidth_mb("bandwidth-mb", "Buffer size per thread of the bandwidth test, in MB", 64);
+named_option s_round_trips("round-trips", "Round trips per core pair of the ping_pong test", 100000);
+
+double nanoseconds(std::chrono::nanoseconds elapsed)
+{
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+// Makes the computation of `value` happen here, before the following clock read: the compiler would otherwise
+// be free to move loads from memory that nothing else sees past it, or drop them.
+template<class T>
+void keep(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+std::string size_name(std::size_t bytes)
+{
+    if (bytes >= (1 << 20))
+        return std::to_string(bytes >> 20) + " MB";
+    return std::to_string(bytes >> 10) + " KB";
+}
+
+// Follows a random cycle through all cache lines of working sets from 4 KB to --max-size-mb. Every load
+// depends on the previous one and the order defeats the prefetchers, so the time per load is the latency of
+// the level the working set fits in.
+bool latency()
+{
+    std::cout << "cache sizes according to sysconf: L1D " << sysconf(_SC_LEVEL1_DCACHE_SIZE) << ", L2 "
+              << sysconf(_SC_LEVEL2_CACHE_SIZE) << ", L3 " << sysconf(_SC_LEVEL3_CACHE_SIZE) << "\n";
+    std::cout << "size\tns/load\n";
+    std::mt19937_64 rng(42);
+    for (std::size_t size = 4096; size <= std::size_t(s_max_size_mb) << 20; size *= 2)
+    {
+        std::size_t n = size / sizeof(cache_aligned<void*>);
+        std::vector<cache_aligned<void*>> lines(n);
+        // Sattolo's algorithm: a random permutation that is a single cycle.
+        std::vector<std::size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        for (std::size_t i = n - 1; i > 0; i--)
+            std::swap(order[i], order[rng() % i]);
+        for (std::size_t i = 0; i < n; i++)
+            lines[i].value = &lines[order[i]].value;
+
+        void* p = &lines[0].value;
+        for (std::size_t i = 0; i < n; i++)  // warm up
+            p = *static_cast<void**>(p);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < s_loads; i++)
+            p = *static_cast<void**>(p);
+        keep(p);
+        auto t1 = std::chrono::steady_clock::now();
+
+        double ns = nanoseconds(t1 - t0) / s_loads;
+        std::cout << size_name(size) << "\t" << ns << "\n";
+        record_sample(size_name(size), ns, "ns/load");
+    }
+    return true;
+}
+named_test s_latency("latency", latency);
+
+// Reads one int every `stride` bytes of a buffer much larger than the caches. The cost per access grows with
+// the stride until every access touches a new line, and then stays flat: the knee is the line size (or
+// twice that, where the CPU fetches lines in pairs).
+bool line_size()
+{
+    std::cout << "cache_line_size " << cache_line_size << ", sysconf L1D line size "
+              << sysconf(_SC_LEVEL1_DCACHE_LINESIZE) << "\n";
+    std::cout << "stride\tns/access\n";
+    const std::size_t size = std::size_t(s_bandwidth_mb) << 20;
+    std::vector<int> buffer(size / sizeof(int), 1);
+    for (std::size_t stride = 8; stride <= 1024; stride *= 2)
+    {
+        std::size_t step = stride / sizeof(int);
+        auto t0 = std::chrono::steady_clock::now();
+        long sum = 0;
+        for (std::size_t i = 0; i < buffer.size(); i += step)
+            sum += buffer[i];
+        keep(sum);
+        auto t1 = std::chrono::steady_clock::now();
+
+        double ns = nanoseconds(t1 - t0) / (buffer.size() / step);
+        std::cout << stride << "\t" << ns << "\n";
+        record_sample(std::to_string(stride) + " bytes", ns, "ns/access");
+    }
+    return true;
+}
+named_test s_line_size("line_size", line_size);
+
+// Every thread sums a buffer of its own of --bandwidth-mb, four times; reports the total read bandwidth for
+// every thread count of --threads.
+bool bandwidth()
+{
+    const std::size_t words = (std::size_t(s_bandwidth_mb) << 20) / sizeof(std::uint64_t);
+    const int passes = 4;
+    std::cout << "threads\tGB/s\n";
+    for (int n : s_threads)
+    {
+        std::vector<std::vector<std::uint64_t>> buffers(n, std::vector<std::uint64_t>(words, 1));
+        per_thread<std::uint64_t> sums(n);
+        auto elapsed = run_threads(n, [&](int thread) {
+            const std::uint64_t* data = buffers[thread].data();
+            std::uint64_t sum = 0;
+            for (int pass = 0; pass < passes; pass++)
+                for (std::size_t i = 0; i < words; i++)
+                    sum += data[i];
+            sums[thread] = sum;
+        });
+        double bytes = double(n) * passes * words * sizeof(std::uint64_t);
+        double ns = nanoseconds(elapsed);
+        std::cout << n << "\t" << bytes / ns << "\n";
+        record_sample(std::to_string(n) + " threads", ns / bytes * 1e9, "ns/GB");
+        if (sums.reduce(std::uint64_t(0), std::plus<>()) != n * passes * words)
+            return false;
+    }
+    return true;
+}
+named_test s_bandwidth("bandwidth", bandwidth);
+
+// How far apart two CPUs are: hardware threads of one core, cores of one package, or different packages.
+const char* relation(const cpu_info& a, const cpu_info& b)
+{
+    if (a.package != b.package)
+        return "different sockets";
+    return a.core == b.core ? "same core" : "different cores";
+}
+
+// Two threads pinned to two CPUs take turns incrementing a counter on one cache line, so every increment
+// has to fetch the line from the other core. Prints the one-way latency (half a round trip) for every pair
+// of CPUs this process may run on, as a matrix, and its mean by how far apart the pairs are (topology.h).
+bool ping_pong()
+{
+    std::vector<cpu_info> cpus = read_cpu_topology();
+    if (cpus.size() < 2)
+    {
+        std::cout << "needs at least two CPUs, have " << cpus.size() << "\n";
+        return true;
+    }
+    std::vector<std::vector<double>> ns(cpus.size(), std::vector<double>(cpus.size()));
+    std::map<std::string, std::pair<double, int>> by_relation;  // sum and count
+    std::atomic<bool> pinned{true};
+    for (std::size_t a = 0; a < cpus.size(); a++)
+        for (std::size_t b = a + 1; b < cpus.size(); b++)
+        {
+            cache_aligned<std::atomic<int>> flag(0);
+            const int pair[2] = { cpus[a].cpu, cpus[b].cpu };
+            auto elapsed = run_threads(2, [&](int thread) {
+                if (not pin_this_thread(pair[thread]))
+                    pinned = false;
+                for (int i = 0; i < s_round_trips; i++)
+                {
+                    int mine = 2 * i + thread;
+                    while (flag->load(std::memory_order_acquire) != mine)
+                        cpu_relax();
+                    flag->store(mine + 1, std::memory_order_release);
+                }
+            });
+            ns[a][b] = ns[b][a] = nanoseconds(elapsed) / (2.0 * s_round_trips);
+            const char* how = relation(cpus[a], cpus[b]);
+            by_relation[how].first += ns[a][b];
+            by_relation[how].second++;
+            record_sample("cpu " + std::to_string(pair[0]) + "-" + std::to_string(pair[1]) + " (" + how + ")",
+                          ns[a][b], "ns");
+        }
+    std::cout << "ns one way";
+    for (const auto& c : cpus)
+        std::cout << "\t" << c.cpu;
+    std::cout << "\n";
+    for (std::size_t a = 0; a < cpus.size(); a++)
+    {
+        std::cout << cpus[a].cpu;
+        for (std::size_t b = 0; b < cpus.size(); b++)
+            if (a == b)
+                std::cout << "\t-";
+            else
+                std::cout << "\t" << ns[a][b];
+        std::cout << "\n";
+    }
+    for (const auto& r : by_relation)
+        std::cout << r.first << ": " << r.second.first / r.second.second << " ns one way (mean of "
+                  << r.second.second << " pairs)\n";
+    return pinned;
+}
+named_test s_ping_pong("ping_pong", ping_pong);
@@ -0,0 +1,89 @@
+#ifndef MPMC_RING_H_
+#define MPMC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include "cache_aligned.h"
+#include "locks.h"
+
+// Bounded multi-producer multi-consumer FIFO on a ring of cells (Vyukov). Every cell has a sequence number
+// that says whose turn it is: the producer of position p may fill it when it reads p, the consumer of p may
+// empty it when it reads p + 1. Producers and consumers claim positions with a CAS on their own counter, so
+// they only meet on the cells. T must be default constructible.
+template<class T>
+class mpmc_ring {
+public:
+    explicit mpmc_ring(std::size_t capacity) : mask(round_up(capacity) - 1), cells(new cell[mask + 1]) {
+        for (std::size_t i = 0; i <= mask; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Moves from value only when it returns true.
+    bool try_push(T&& value) {
+        std::size_t pos = push_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            std::intptr_t dif = std::intptr_t(c.seq.load(std::memory_order_acquire)) - std::intptr_t(pos);
+            if (dif == 0) {
+                if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(value);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+                return false;  // full
+            else
+                pos = push_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Waits while the ring is full.
+    void push(T value) {
+        backoff wait;
+        while (not try_push(std::move(value)))
+            wait();
+    }
+
+    bool try_pop(T& value) {
+        std::size_t pos = pop_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            std::intptr_t dif = std::intptr_t(c.seq.load(std::memory_order_acquire)) - std::intptr_t(pos + 1);
+            if (dif == 0) {
+                if (pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(c.value);
+                    c.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+                return false;  // empty
+            else
+                pos = pop_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t p = 1;
+        while (p < n)
+            p *= 2;
+        return p;
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<cell[]> cells;
+    alignas(cache_line_size) std::atomic<std::size_t> push_pos{0};
+    alignas(cache_line_size) std::atomic<std::size_t> pop_pos{0};
+};
+
+#endif /* MPMC_RING_H_ */
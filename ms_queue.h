@@ -0,0 +1,164 @@
+#ifndef MS_QUEUE_H_
+#define MS_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "cache_aligned.h"
+#include "epoch.h"
+
+// Unbounded lock-free multi-producer multi-consumer FIFO (Michael & Scott, 1996): a linked list with a dummy
+// node at the head, where producers link new nodes after the tail and consumers advance the head. Whoever
+// finds the tail lagging behind the last node advances it first, so no operation waits for another.
+// Popped nodes are retired through epoch.h, as other threads may still be looking at them, and then go to a
+// free list of the thread that popped them instead of back to the allocator; lists that grow too long (as
+// they do in threads that only pop) hand batches over to threads whose lists are empty.
+template<class T>
+class ms_queue {
+public:
+    ms_queue() {
+        node* dummy = node_pool::get();
+        head.store(dummy, std::memory_order_relaxed);
+        tail.store(dummy, std::memory_order_relaxed);
+    }
+
+    ms_queue(const ms_queue&) = delete;
+    ms_queue& operator=(const ms_queue&) = delete;
+
+    // There must be no other threads using the queue any more.
+    ~ms_queue() {
+        node* n = head.load(std::memory_order_relaxed);
+        for (node* next; (next = n->next.load(std::memory_order_relaxed)); n = next) {
+            node_pool::put(n);
+            std::launder(reinterpret_cast<T*>(&next->storage))->~T();
+        }
+        node_pool::put(n);
+    }
+
+    void push(T value) {
+        node* n = node_pool::get();
+        new (&n->storage) T(std::move(value));
+        n->next.store(nullptr, std::memory_order_relaxed);
+        epoch_guard guard;
+        for (;;) {
+            node* t = tail.load(std::memory_order_acquire);
+            node* next = t->next.load(std::memory_order_acquire);
+            if (t != tail.load(std::memory_order_acquire))
+                continue;
+            if (next) {
+                tail.compare_exchange_weak(t, next, std::memory_order_release, std::memory_order_relaxed);
+                continue;
+            }
+            if (t->next.compare_exchange_weak(next, n, std::memory_order_release, std::memory_order_relaxed)) {
+                tail.compare_exchange_strong(t, n, std::memory_order_release, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        epoch_guard guard;
+        for (;;) {
+            node* h = head.load(std::memory_order_acquire);
+            node* t = tail.load(std::memory_order_acquire);
+            node* next = h->next.load(std::memory_order_acquire);
+            if (h != head.load(std::memory_order_acquire))
+                continue;
+            if (not next)
+                return false;
+            if (h == t) {
+                tail.compare_exchange_weak(t, next, std::memory_order_release, std::memory_order_relaxed);
+                continue;
+            }
+            if (head.compare_exchange_weak(h, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                // next is the new dummy; its value is ours alone now.
+                T* v = std::launder(reinterpret_cast<T*>(&next->storage));
+                value = std::move(*v);
+                v->~T();
+                epoch_domain::global().retire(h, [](void* p) { node_pool::put(static_cast<node*>(p)); });
+                return true;
+            }
+        }
+    }
+
+private:
+    struct node {
+        std::atomic<node*> next{nullptr};
+        alignas(T) unsigned char storage[sizeof(T)];  // holds a value from push until pop
+    };
+
+    // Free nodes of the calling thread, and batches handed over between threads.
+    class node_pool {
+    public:
+        ~node_pool() {
+            if (not free.empty())
+                shared().give(std::move(free));
+        }
+
+        static node* get() {
+            auto& pool = local();
+            if (pool.free.empty())
+                pool.free = shared().take();
+            if (pool.free.empty())
+                return new node;
+            node* n = pool.free.back();
+            pool.free.pop_back();
+            return n;
+        }
+
+        static void put(node* n) {
+            auto& pool = local();
+            pool.free.push_back(n);
+            if (pool.free.size() >= 2 * batch) {
+                std::vector<node*> half(pool.free.end() - batch, pool.free.end());
+                pool.free.resize(pool.free.size() - batch);
+                shared().give(std::move(half));
+            }
+        }
+
+    private:
+        static constexpr std::size_t batch = 256;
+
+        struct exchange {
+            ~exchange() {
+                for (auto& b : batches)
+                    for (node* n : b)
+                        delete n;
+            }
+            void give(std::vector<node*> b) {
+                std::lock_guard<std::mutex> lock(mtx);
+                batches.push_back(std::move(b));
+            }
+            std::vector<node*> take() {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (batches.empty())
+                    return {};
+                std::vector<node*> b = std::move(batches.back());
+                batches.pop_back();
+                return b;
+            }
+            std::mutex mtx;
+            std::vector<std::vector<node*>> batches;
+        };
+
+        static node_pool& local() {
+            thread_local node_pool pool;
+            return pool;
+        }
+
+        static exchange& shared() {
+            static exchange e;
+            return e;
+        }
+
+        std::vector<node*> free;
+    };
+
+    alignas(cache_line_size) std::atomic<node*> head;
+    alignas(cache_line_size) std::atomic<node*> tail;
+};
+
+#endif /* MS_QUEUE_H_ */
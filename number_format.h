@@ -0,0 +1,76 @@
+#ifndef NUMBER_FORMAT_H_
+#define NUMBER_FORMAT_H_
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+
+// Number to text conversion for the formatters. Every function writes into a buffer of at least
+// max_number_chars bytes and returns the end of what it wrote (no terminating null).
+constexpr std::size_t max_number_chars = 32;
+
+enum class float_style {
+    general,   // 6 significant digits, as printf("%g") and std::ostream's default
+    shortest,  // the fewest digits that parse back to the same double
+    lexeme,    // the number exactly as written in the input, which the parser passes along instead of the double
+};
+
+// "00" "01" ... "99": two digits per division.
+constexpr char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+inline unsigned decimal_digits(std::uint64_t value) {
+    unsigned n = 1;
+    for (;;) {
+        if (value < 10) return n;
+        if (value < 100) return n + 1;
+        if (value < 1000) return n + 2;
+        if (value < 10000) return n + 3;
+        value /= 10000;
+        n += 4;
+    }
+}
+
+// Know the length up front, then fill in two digits at a time from the back.
+inline char* format_unsigned(char* p, std::uint64_t value) {
+    char* end = p + decimal_digits(value);
+    char* q = end;
+    while (value >= 100) {
+        unsigned pair = value % 100 * 2;
+        value /= 100;
+        *--q = digit_pairs[pair + 1];
+        *--q = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--q = digit_pairs[value * 2 + 1];
+        *--q = digit_pairs[value * 2];
+    }
+    else
+        *--q = char('0' + value);
+    return end;
+}
+
+inline char* format_signed(char* p, std::int64_t value) {
+    std::uint64_t magnitude = value;
+    if (value < 0) {
+        *p++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    return format_unsigned(p, magnitude);
+}
+
+// Without floating point std::to_chars (before gcc 11) the shortest style falls back to 17 digits, which also
+// parses back to the same double but is not the shortest such text.
+inline char* format_float(char* p, double value, float_style style) {
+#ifdef HAVE_FLOAT_TO_CHARS
+    if (style == float_style::shortest)
+        return std::to_chars(p, p + max_number_chars, value).ptr;
+    return std::to_chars(p, p + max_number_chars, value, std::chars_format::general, 6).ptr;
+#else
+    return p + std::snprintf(p, max_number_chars, style == float_style::shortest ? "%.17g" : "%g", value);
+#endif
+}
+
+#endif /* NUMBER_FORMAT_H_ */
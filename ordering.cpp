@@ -1,227 +1,502 @@
 #include "test_main.h"
+#include "cache_aligned.h"
+#include "spin_barrier.h"
+#include <array>
+#include <map>
 #include <random>
 #include <chrono>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include <utility>
+#include <vector>
 
-class repetitive_task
+named_option s_batch("batch", "Litmus test instances per round", 10000);
+named_option s_stress("stress", "Threads that keep the memory system busy during litmus tests", 0);
+
+// A litmus test is a struct holding the locations and registers of one instance, with
+//   static constexpr int threads;           how many threads the test has
+//   template<int I> void op();              what thread I does
+//   void reset();                           sets up the initial state
+//   std::array<int, N> outcome() const;     what the test observed: registers, and final values of locations
+//   static constexpr std::array<const char*, N> names;  names of the observed values
+//   static constexpr std::array<int, N> target;         the outcome the test is looking for
+//   static constexpr bool forbidden;        whether the memory model forbids the target; the test fails if seen
+// run<T> instantiates every op directly in the loop over the instances, so no call surrounds the memory
+// operations being tested.
+
+// Streams writes over private cache lines until told to stop.
+void stress(const std::atomic<bool>& stop)
 {
-public:
-    template<class F>
-    repetitive_task(F&& f) : m_f(f) {
-        m_twister.seed(std::chrono::steady_clock::now().time_since_epoch().count());
-        m_thread = std::thread([this]() {
-            for (;;)
-            {
-                std::unique_lock<std::mutex> lk(m_mtx);
-                m_cv.wait(lk, [this]{return m_ready or m_stop;});
-                if (m_stop) return;
+    std::vector<cache_aligned<int>> lines(4096);
+    while (not stop.load(std::memory_order_relaxed))
+        for (auto& line : lines)
+            line.value++;
+}
 
-                while (m_twister() % 8 != 0) {}  // Short, random delay
+// Runs op<I> of T over all instances, for the I that is `thread`.
+template<class T, std::size_t... I>
+void run_op(int thread, std::vector<T>& instances, std::index_sequence<I...>)
+{
+    auto run_all = [&](auto i) {
+        for (auto& t : instances)
+            t.template op<decltype(i)::value>();
+    };
+    ((thread == int(I) ? run_all(std::integral_constant<int, I>()) : void()), ...);
+}
 
-                m_f();
+// Runs s_iterations trials of T in rounds of s_batch independent instances. In every round, all threads
+// leave a spin barrier together and run their op over all instances in the same order, so they race on
+// every instance with about the skew of the barrier; a short random delay varies that skew between rounds.
+// Then thread 0 tallies the outcomes and resets the instances for the next round.
+template<class T>
+bool run()
+{
+    const long batch = std::max(1, int(s_batch));
+    const long rounds = (s_iterations + batch - 1) / batch;
+    std::vector<T> instances(batch);
+    for (auto& t : instances)
+        t.reset();
+    std::map<decltype(T::target), long> histogram;
 
-                m_ready = false;
-                m_done = true;
-                lk.unlock();
-                m_cv.notify_all();
-            }
-        });
-    }
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> stressors;
+    for (int i = 0; i < s_stress; i++)
+        stressors.emplace_back(stress, std::cref(stop));
 
-    ~repetitive_task()
-    {
+    spin_barrier barrier(T::threads);
+    auto elapsed = run_threads(T::threads, [&](int thread) {
+        std::minstd_rand rng(thread + 1);
+        bool sense = false;
+        for (long r = 0; r < rounds; r++)
         {
-            std::lock_guard<std::mutex> lk(m_mtx);
-            m_stop = true;
+            barrier.wait(sense);
+            for (unsigned delay = rng() % 8; delay; delay--)
+                cpu_relax();
+            run_op(thread, instances, std::make_index_sequence<T::threads>());
+            barrier.wait(sense);
+            if (thread == 0)
+                for (auto& t : instances)
+                {
+                    histogram[t.outcome()]++;
+                    t.reset();
+                }
         }
-        m_cv.notify_all();
-        m_thread.join();
-    }
+    });
+    stop = true;
+    for (auto& t : stressors)
+        t.join();
 
-    void go()
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    long trials = rounds * batch;
+    std::cout << trials << " trials in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+              << " ms, " << 1e3 * trials / ns << " Mtrials/s.\n";
+    record_sample("trial", ns / trials, "ns/trial");
+    bool ok = true;
+    for (const auto& [outcome, count] : histogram)
     {
+        std::cout << " ";
+        for (std::size_t i = 0; i < outcome.size(); i++)
+            std::cout << " " << T::names[i] << "=" << outcome[i];
+        std::cout << "  " << count;
+        if (outcome == T::target)
         {
-            std::lock_guard<std::mutex> lk(m_mtx);
-            m_done = false;
-            m_ready = true;
+            std::cout << (T::forbidden ? "  forbidden" : "  allowed");
+            ok = ok and not T::forbidden;
         }
-        m_cv.notify_all();
-    }
-
-    void wait()
-    {
-        std::unique_lock<std::mutex> lk(m_mtx);
-        m_cv.wait(lk, [this]{return m_done;});
+        std::cout << "\n";
     }
-
-private:
-    std::mt19937 m_twister;
-    std::mutex m_mtx;
-    std::condition_variable m_cv;
-    bool m_ready = false;
-    bool m_done = false;
-    std::function<void()> m_f;
-    std::thread m_thread;
-    bool m_stop = false;
+    return ok;
 };
 
-struct test
-{
-    virtual ~test() {}
+#define REGISTER_TEST(impl) named_test s_##impl(#impl, []() { return run<impl>(); });
 
-    virtual void reset() = 0;
-    virtual void op1() = 0;
-    virtual void op2() = 0;
-    virtual bool eval() = 0;
-};
+enum class fence { none, compiler, acquire, release, acq_rel, seq_cst };
 
-template<class T>
-bool run(T t)
+template<fence F>
+void fence_op()
 {
-    repetitive_task t1([&t]() { t.op1(); });
-    repetitive_task t2([&t]() { t.op2(); });
+    if constexpr (F == fence::compiler)
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    else if constexpr (F == fence::acquire)
+        std::atomic_thread_fence(std::memory_order_acquire);
+    else if constexpr (F == fence::release)
+        std::atomic_thread_fence(std::memory_order_release);
+    else if constexpr (F == fence::acq_rel)
+        std::atomic_thread_fence(std::memory_order_acq_rel);
+    else if constexpr (F == fence::seq_cst)
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+}
 
-    for (int i = 0; i < s_iterations; i++)
-    {
-        t.reset();
-        t1.go();
-        t2.go();
-        t1.wait();
-        t2.wait();
-        if (not t.eval())
-        {
-            std::cerr << "Failure on iteration #" << i << std::endl;
-            return false;
-        }
-    }
-    return true;
-};
+constexpr auto relaxed = std::memory_order_relaxed;
 
-#define REGISTER_TEST(impl) named_test s_##impl(#impl, []() { return run(impl()); });
 
-struct store_load : test
+// Store buffering with plain ints: neither the compiler nor an x86 CPU keeps the store before the load.
+struct store_load
 {
-    void reset() override
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"r1", "r2"};
+    static constexpr std::array<int, 2> target = {0, 0};
+    static constexpr bool forbidden = true;
+
+    void reset()
     {
         X = 0;
         Y = 0;
         r1 = 1;
         r2 = 1;
     }
-    void op1() override
+    template<int I> void op()
     {
-        X = 1;
-        r1 = Y;
-    }
-    void op2() override
-    {
-        Y = 1;
-        r2 = X;
+        if constexpr (I == 0)
+        {
+            X = 1;
+            r1 = Y;
+        }
+        else
+        {
+            Y = 1;
+            r2 = X;
+        }
     }
-    bool eval() override
+    std::array<int, 2> outcome() const
     {
-        return not (r1 == 0 and r2 == 0);
+        return {r1, r2};
     }
     int X, Y;
     int r1, r2;
 };
 REGISTER_TEST(store_load);
 
-struct store_load_safe : test
+struct store_load_safe
 {
-    void reset() override
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"r1", "r2"};
+    static constexpr std::array<int, 2> target = {0, 0};
+    static constexpr bool forbidden = true;
+
+    void reset()
     {
         X = 0;
         Y = 0;
         r1 = 1;
         r2 = 1;
     }
-    void op1() override
+    template<int I> void op()
     {
-        X = 1;
-        r1 = Y;
-    }
-    void op2() override
-    {
-        Y = 1;
-        r2 = X;
+        if constexpr (I == 0)
+        {
+            X = 1;
+            r1 = Y;
+        }
+        else
+        {
+            Y = 1;
+            r2 = X;
+        }
     }
-    bool eval() override
+    std::array<int, 2> outcome() const
     {
-        return not (r1 == 0 and r2 == 0);
+        return {r1, r2};
     }
     std::atomic<int> X, Y;
     int r1, r2;
 };
 REGISTER_TEST(store_load_safe);
 
-struct load_store : test
+struct load_store
 {
-    void reset() override
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"r1", "r2"};
+    static constexpr std::array<int, 2> target = {1, 1};
+    static constexpr bool forbidden = true;
+
+    void reset()
     {
         X = 0;
         Y = 0;
         r1 = 0;
         r2 = 0;
     }
-    void op1() override
+    template<int I> void op()
     {
-        r1 = Y;
-        X = 1;
-    }
-    void op2() override
-    {
-        r2 = X;
-        Y = 1;
+        if constexpr (I == 0)
+        {
+            r1 = Y;
+            X = 1;
+        }
+        else
+        {
+            r2 = X;
+            Y = 1;
+        }
     }
-    bool eval() override
+    std::array<int, 2> outcome() const
     {
-        return not (r1 == 1 and r2 == 1);
+        return {r1, r2};
     }
-    int X;
-    char padding1[128];
-    int Y;
-    char padding2[128];
-    int r1;
-    char padding3[128];
-    int r2;
+    alignas(cache_line_size) int X;
+    alignas(cache_line_size) int Y;
+    alignas(cache_line_size) int r1;
+    alignas(cache_line_size) int r2;
 };
 REGISTER_TEST(load_store);
 
 
-struct mp : test
+struct mp
 {
-    void reset() override
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"r1", "r2"};
+    static constexpr std::array<int, 2> target = {1, 0};
+    static constexpr bool forbidden = true;
+
+    void reset()
     {
         X = 0;
         Y = 0;
         r1 = 0;
         r2 = 0;
     }
-    void op1() override
+    template<int I> void op()
+    {
+        if constexpr (I == 0)
+        {
+            X = 1;
+            Y = 1;
+        }
+        else
+        {
+            r1 = Y;
+            r2 = X;
+        }
+    }
+    std::array<int, 2> outcome() const
     {
-        X = 1;
-        Y = 1;
+        return {r1, r2};
     }
-    void op2() override
+    alignas(cache_line_size) int X;
+    alignas(cache_line_size) int Y;
+    alignas(cache_line_size) int r1;
+    alignas(cache_line_size) int r2;
+};
+REGISTER_TEST(mp);
+
+
+// SB (store buffering) with relaxed atomics and a fence between the store and the load. Only seq_cst fences
+// forbid both loads reading 0.
+template<fence F>
+struct sb
+{
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"r0", "r1"};
+    static constexpr std::array<int, 2> target = {0, 0};
+    static constexpr bool forbidden = F == fence::seq_cst;
+
+    void reset()
     {
-        r1 = Y;
-        r2 = X;
+        x.store(0, relaxed);
+        y.store(0, relaxed);
     }
-    bool eval() override
+    template<int I> void op()
     {
-        //std::cout << "r1=" << r1 << " r2=" << r2 << "\n";
-        return not (r1 == 1 and r2 == 0);
+        if constexpr (I == 0)
+        {
+            x.store(1, relaxed);
+            fence_op<F>();
+            r0 = y.load(relaxed);
+        }
+        else
+        {
+            y.store(1, relaxed);
+            fence_op<F>();
+            r1 = x.load(relaxed);
+        }
     }
-    int X;
-    char padding1[4096];
-    int Y;
-    char padding2[4096];
-    int r1;
-    char padding3[4096];
-    int r2;
+    std::array<int, 2> outcome() const
+    {
+        return {r0, r1};
+    }
+    alignas(cache_line_size) std::atomic<int> x;
+    alignas(cache_line_size) std::atomic<int> y;
+    int r0, r1;
 };
-REGISTER_TEST(mp);
+using sb_no_fence = sb<fence::none>;
+REGISTER_TEST(sb_no_fence);
+using sb_compiler_fence = sb<fence::compiler>;
+REGISTER_TEST(sb_compiler_fence);
+using sb_acquire_fence = sb<fence::acquire>;
+REGISTER_TEST(sb_acquire_fence);
+using sb_release_fence = sb<fence::release>;
+REGISTER_TEST(sb_release_fence);
+using sb_acq_rel_fence = sb<fence::acq_rel>;
+REGISTER_TEST(sb_acq_rel_fence);
+using sb_seq_cst_fence = sb<fence::seq_cst>;
+REGISTER_TEST(sb_seq_cst_fence);
+
+// IRIW (independent reads of independent writes): two readers must agree on the order of two writes to
+// different locations. Only seq_cst guarantees that; POWER and older ARM show the disagreement.
+template<std::memory_order Load>
+struct iriw
+{
+    static constexpr int threads = 4;
+    static constexpr std::array<const char*, 4> names = {"r0", "r1", "r2", "r3"};
+    static constexpr std::array<int, 4> target = {1, 0, 1, 0};
+    static constexpr bool forbidden = Load == std::memory_order_seq_cst;
+    static constexpr std::memory_order Store = Load == std::memory_order_seq_cst ? Load : std::memory_order_release;
+
+    void reset()
+    {
+        x.store(0, relaxed);
+        y.store(0, relaxed);
+    }
+    template<int I> void op()
+    {
+        if constexpr (I == 0)
+            x.store(1, Store);
+        else if constexpr (I == 1)
+            y.store(1, Store);
+        else if constexpr (I == 2)
+        {
+            r0 = x.load(Load);
+            r1 = y.load(Load);
+        }
+        else
+        {
+            r2 = y.load(Load);
+            r3 = x.load(Load);
+        }
+    }
+    std::array<int, 4> outcome() const
+    {
+        return {r0, r1, r2, r3};
+    }
+    alignas(cache_line_size) std::atomic<int> x;
+    alignas(cache_line_size) std::atomic<int> y;
+    alignas(cache_line_size) int r0, r1;
+    alignas(cache_line_size) int r2, r3;
+};
+using iriw_acquire = iriw<std::memory_order_acquire>;
+REGISTER_TEST(iriw_acquire);
+using iriw_seq_cst = iriw<std::memory_order_seq_cst>;
+REGISTER_TEST(iriw_seq_cst);
+
+// 2+2W: two threads write both locations in opposite orders; the first write of each surviving would mean
+// the writes were ordered differently for the two locations.
+template<std::memory_order Store>
+struct two_plus_two_w
+{
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"x", "y"};
+    static constexpr std::array<int, 2> target = {1, 1};
+    static constexpr bool forbidden = Store == std::memory_order_seq_cst;
+
+    void reset()
+    {
+        x.store(0, relaxed);
+        y.store(0, relaxed);
+    }
+    template<int I> void op()
+    {
+        if constexpr (I == 0)
+        {
+            x.store(1, Store);
+            y.store(2, Store);
+        }
+        else
+        {
+            y.store(1, Store);
+            x.store(2, Store);
+        }
+    }
+    std::array<int, 2> outcome() const
+    {
+        return {x.load(relaxed), y.load(relaxed)};
+    }
+    alignas(cache_line_size) std::atomic<int> x;
+    alignas(cache_line_size) std::atomic<int> y;
+};
+using two_plus_two_w_relaxed = two_plus_two_w<std::memory_order_relaxed>;
+REGISTER_TEST(two_plus_two_w_relaxed);
+using two_plus_two_w_seq_cst = two_plus_two_w<std::memory_order_seq_cst>;
+REGISTER_TEST(two_plus_two_w_seq_cst);
+
+// R: thread 1's store to y is last in y's coherence order, yet its later load misses thread 0's earlier store
+// to x. That is store buffering in disguise, so it needs seq_cst as well.
+template<std::memory_order Order>
+struct r
+{
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"y", "r0"};
+    static constexpr std::array<int, 2> target = {2, 0};
+    static constexpr bool forbidden = Order == std::memory_order_seq_cst;
+
+    void reset()
+    {
+        x.store(0, relaxed);
+        y.store(0, relaxed);
+    }
+    template<int I> void op()
+    {
+        if constexpr (I == 0)
+        {
+            x.store(1, Order);
+            y.store(1, Order);
+        }
+        else
+        {
+            y.store(2, Order);
+            r0 = x.load(Order);
+        }
+    }
+    std::array<int, 2> outcome() const
+    {
+        return {y.load(relaxed), r0};
+    }
+    alignas(cache_line_size) std::atomic<int> x;
+    alignas(cache_line_size) std::atomic<int> y;
+    int r0;
+};
+using r_relaxed = r<std::memory_order_relaxed>;
+REGISTER_TEST(r_relaxed);
+using r_seq_cst = r<std::memory_order_seq_cst>;
+REGISTER_TEST(r_seq_cst);
+
+// S: thread 1 reads thread 0's flag, then writes x, yet thread 0's earlier write to x ends up last.
+// Release/acquire on the flag forbids that.
+template<bool ReleaseAcquire>
+struct s
+{
+    static constexpr int threads = 2;
+    static constexpr std::array<const char*, 2> names = {"x", "r0"};
+    static constexpr std::array<int, 2> target = {2, 1};
+    static constexpr bool forbidden = ReleaseAcquire;
+
+    void reset()
+    {
+        x.store(0, relaxed);
+        y.store(0, relaxed);
+    }
+    template<int I> void op()
+    {
+        if constexpr (I == 0)
+        {
+            x.store(2, relaxed);
+            y.store(1, ReleaseAcquire ? std::memory_order_release : relaxed);
+        }
+        else
+        {
+            r0 = y.load(ReleaseAcquire ? std::memory_order_acquire : relaxed);
+            x.store(1, relaxed);
+        }
+    }
+    std::array<int, 2> outcome() const
+    {
+        return {x.load(relaxed), r0};
+    }
+    alignas(cache_line_size) std::atomic<int> x;
+    alignas(cache_line_size) std::atomic<int> y;
+    int r0;
+};
+using s_relaxed = s<false>;
+REGISTER_TEST(s_relaxed);
+using s_release_acquire = s<true>;
+REGISTER_TEST(s_release_acquire);
@@ -0,0 +1,145 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware counters of the calling thread and of all threads it starts while they are enabled, via
+// perf_event_open(2). Counters the kernel or the CPU doesn't offer (or that perf_event_paranoid forbids) are
+// left out and reported as unavailable, so the harness still runs without them.
+class perf_counters {
+public:
+    perf_counters() {
+        add("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        add("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        add("L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        add("LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#if defined(__x86_64__) || defined(__i386__)
+        // Loads that hit a line modified in another core's cache: the cost of true and false sharing.
+        // MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM (event 0xd2, umask 0x04) on the Skylake-derived cores listed in
+        // has_xsnp_hitm(); other models (Atom, hybrid E-cores, ...) count something else under that code.
+        if (has_xsnp_hitm())
+            add("HITM loads", PERF_TYPE_RAW, 0x04d2);
+        else
+            counters.push_back({ "HITM loads", -1, ENOTSUP });
+#endif
+    }
+
+    ~perf_counters() {
+        for (auto& c : counters)
+            if (c.fd >= 0)
+                close(c.fd);
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    void start() {
+        for (auto& c : counters)
+            if (c.fd >= 0) {
+                ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+    }
+
+    void stop() {
+        for (auto& c : counters)
+            if (c.fd >= 0)
+                ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // Counts since start(), scaled up when the kernel had to multiplex the counters.
+    void report(std::ostream& os) const {
+        std::uint64_t cycles = 0, instructions = 0;
+        for (const auto& c : counters) {
+            os << "  " << c.name << ": ";
+            std::uint64_t value;
+            if (c.fd < 0)
+                os << "unavailable (" << std::strerror(c.error) << ")\n";
+            else if (not read(c, value))
+                os << "unreadable\n";
+            else {
+                os << value << "\n";
+                if (c.name == "cycles")
+                    cycles = value;
+                if (c.name == "instructions")
+                    instructions = value;
+            }
+        }
+        if (cycles and instructions)
+            os << "  IPC: " << double(instructions) / cycles << "\n";
+    }
+
+private:
+    struct counter {
+        std::string name;
+        int fd;
+        int error;
+    };
+
+    void add(const char* name, std::uint32_t type, std::uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;        // count the test's threads too
+        attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counters.push_back({ name, fd, fd < 0 ? errno : 0 });
+    }
+
+    static bool read(const counter& c, std::uint64_t& value) {
+        std::uint64_t data[3]; // value, time enabled, time running
+        if (::read(c.fd, data, sizeof(data)) != sizeof(data))
+            return false;
+        value = data[2] ? std::uint64_t(double(data[0]) * data[1] / data[2]) : data[0];
+        return true;
+    }
+
+    // Intel family 6 models from Skylake to Rocket Lake, client and server, by /proc/cpuinfo.
+    static bool has_xsnp_hitm() {
+        std::string vendor;
+        int family = -1, model = -1;
+        std::ifstream is("/proc/cpuinfo");
+        for (std::string line; std::getline(is, line) and not line.empty();) {
+            std::string key = line.substr(0, line.find('\t'));
+            std::string value = line.substr(line.find(':') + 1);
+            if (key == "vendor_id")
+                vendor = value.substr(1);
+            else if (key == "cpu family")
+                family = std::atoi(value.c_str());
+            else if (key == "model")
+                model = std::atoi(value.c_str());
+        }
+        const int models[] = {
+            0x4e, 0x5e,                   // Skylake
+            0x8e, 0x9e, 0xa5, 0xa6,       // Kaby Lake, Coffee Lake, Comet Lake
+            0x55,                         // Skylake-SP, Cascade Lake, Cooper Lake
+            0x66,                         // Cannon Lake
+            0x7d, 0x7e, 0x6a, 0x6c,       // Ice Lake, Ice Lake-SP
+            0x8c, 0x8d, 0xa7,             // Tiger Lake, Rocket Lake
+        };
+        return vendor == "GenuineIntel" and family == 6
+            and std::find(std::begin(models), std::end(models), model) != std::end(models);
+    }
+
+    std::vector<counter> counters;
+};
+
+#endif /* PERF_COUNTERS_H_ */
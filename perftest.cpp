@@ -1,142 +1,545 @@
 #include "test_main.h"
+#include "cache_aligned.h"
+#include "lazy.h"
+#include "locks.h"
+#include "seqlock.h"
+#include "sharded_counter.h"
+#include "snapshot.h"
 #include <chrono>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
+#include <array>
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
 
-struct test
-{
-    virtual ~test() {}
-
-    virtual void op1() = 0;
-    virtual void op2() = 0;
-    virtual bool eval() = 0;
-};
+// A test is a struct with
+//   void op1(int thread), op2(int thread);  the operations, which get the index of the thread running them
+//   bool eval(long n1, long n2);            checks the result, told how often each op ran in total
+// Every thread runs op1 or op2 (see --ops) s_iterations times. run<T> calls them on a T, not through a base
+// class, so they are inlined into the timed loops.
 
+// Runs a fresh T for every thread count of the sweep, reporting the time per op of a single thread
+// and the throughput of all threads together.
 template<class T>
-bool run(T t)
-{
-    auto t0 = std::chrono::steady_clock::now();
-    std::thread thr1([&]() { for (int i = 0; i < s_iterations; i++) t.op1(); });
-    std::thread thr2([&]() { for (int i = 0; i < s_iterations; i++) t.op2(); });
-    thr1.join();
-    thr2.join();
-    auto t1 = std::chrono::steady_clock::now();
-    std::cout << "It took " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms.\n";
-    return t.eval();
+bool run()
+{
+    bool ok = true;
+    for (int n : s_threads)
+    {
+        auto t = std::make_unique<T>();
+        long count[2] = {};
+        for (int i = 0; i < n; i++)
+            count[op_of_thread(i) == 2] += s_iterations;
+        auto elapsed = run_threads(n, [&](int thread) {
+            if (op_of_thread(thread) == 2)
+                for (int i = 0; i < s_iterations; i++) t->op2(thread);
+            else
+                for (int i = 0; i < s_iterations; i++) t->op1(thread);
+        });
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        std::cout << n << " threads: it took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                  << " ms, " << ns / s_iterations << " ns/op, " << 1e3 * n * s_iterations / ns << " Mops/s.\n";
+        record_sample(std::to_string(n) + " threads", ns / s_iterations);
+        ok = t->eval(count[0], count[1]) and ok;
+    }
+    return ok;
 }
 
-#define REGISTER_TEST(impl) named_test s_##impl(#impl, []() { return run(impl()); });
+#define REGISTER_TEST(impl) named_test s_##impl(#impl, []() { return run<impl>(); });
 
 
-struct contended_int : test
+struct contended_int
 {
-    void op1() override
+    void op1(int)
     {
         X++;
     }
-    void op2() override
+    void op2(int)
     {
         X--;
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X == 0;
+        return X == n1 - n2;
     }
-    volatile int X = 0;
+    volatile long X = 0;
 };
 REGISTER_TEST(contended_int);
 
-struct uncontended_int : test
+// Every thread increments a counter of its own, two cache lines away from the next one: with one line,
+// adjacent-line prefetch could pair neighbours up and bring false sharing back into this baseline.
+struct uncontended_int
 {
-    void op1() override
+    void op1(int thread)
     {
-        X++;
+        X[thread % max_threads]++;
     }
-    void op2() override
+    void op2(int thread)
     {
-        Y++;
+        X[thread % max_threads]++;
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X == s_iterations and Y == s_iterations;
+        return X.reduce(0L, [](long sum, long x) { return sum + x; }) == n1 + n2;
     }
-    volatile int X = 0;
-    char padding[256];
-    volatile int Y = 0;
+    static constexpr int max_threads = 256;
+    per_thread<volatile long, 2> X{max_threads};
 };
 REGISTER_TEST(uncontended_int);
 
 
-struct atomic_fetch_add_relaxed : test
+struct atomic_fetch_add_relaxed
 {
-    void op1() override
+    void op1(int)
     {
         X.fetch_add(1, std::memory_order_relaxed);
     }
-    void op2() override
+    void op2(int)
     {
         X.fetch_add(-1, std::memory_order_relaxed);
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X.load() == 0;
+        return X.load() == n1 - n2;
     }
-    std::atomic<int> X = 0;
+    std::atomic<long> X = 0;
 };
 REGISTER_TEST(atomic_fetch_add_relaxed);
 
-struct atomic_fetch_add_seq_cst : test
+struct atomic_fetch_add_seq_cst
 {
-    void op1() override
+    void op1(int)
     {
         X++;
     }
-    void op2() override
+    void op2(int)
     {
         X--;
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X.load() == 0;
+        return X.load() == n1 - n2;
     }
-    std::atomic<int> X = 0;
+    std::atomic<long> X = 0;
 };
 REGISTER_TEST(atomic_fetch_add_seq_cst);
 
-struct atomic_load_store_relaxed : test
+struct atomic_load_store_relaxed
 {
-    void op1() override
+    void op1(int)
     {
         X.store(X.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
-    void op2() override
+    void op2(int)
     {
         X.store(X.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X.load() == 0;
+        return X.load() == n1 - n2;
     }
-    std::atomic<int> X = 0;
+    std::atomic<long> X = 0;
 };
 REGISTER_TEST(atomic_load_store_relaxed);
 
-struct atomic_load_store_seq_cst : test
+struct atomic_load_store_seq_cst
 {
-    void op1() override
+    void op1(int)
     {
         X = X + 1;
     }
-    void op2() override
+    void op2(int)
     {
         X = X - 1;
     }
-    bool eval() override
+    bool eval(long n1, long n2)
     {
-        return X.load() == 0;
+        return X.load() == n1 - n2;
     }
-    std::atomic<int> X = 0;
+    std::atomic<long> X = 0;
 };
 REGISTER_TEST(atomic_load_store_seq_cst);
+
+// Cost of every atomic operation by memory order, operand width and what other threads do to its cache line,
+// generated from the lists below. Thread 0 runs the operation s_matrix_iterations times on a line that is
+// its own (private), that the other threads keep loading (shared-read) or that they keep storing to
+// (shared-write); with --threads, every thread count from 2 up is a row of its own for the shared levels.
+// Prints one tab-separated row per cell, so tables from different machines can be diffed.
+named_option s_matrix_iterations("matrix-iterations", "Operations per cell of atomic_matrix", 1000000);
+
+enum class atomic_op { load, store, exchange, cas_loop, fetch_or, fetch_add };
+enum class contention { private_line, shared_read, shared_write };
+
+constexpr std::array<atomic_op, 6> matrix_ops = {
+    atomic_op::load, atomic_op::store, atomic_op::exchange, atomic_op::cas_loop, atomic_op::fetch_or, atomic_op::fetch_add
+};
+constexpr std::array<std::memory_order, 5> matrix_orders = {
+    std::memory_order_relaxed, std::memory_order_acquire, std::memory_order_release, std::memory_order_acq_rel,
+    std::memory_order_seq_cst
+};
+
+const char* name(atomic_op op)
+{
+    const char* names[] = { "load", "store", "exchange", "cas_loop", "fetch_or", "fetch_add" };
+    return names[int(op)];
+}
+
+const char* name(std::memory_order order)
+{
+    const char* names[] = { "relaxed", "consume", "acquire", "release", "acq_rel", "seq_cst" };
+    return names[int(order)];
+}
+
+const char* name(contention c)
+{
+    const char* names[] = { "private", "shared-read", "shared-write" };
+    return names[int(c)];
+}
+
+// Loads only take relaxed, acquire and seq_cst, stores relaxed, release and seq_cst. 16-byte operands are
+// only measured with the compare-and-swap loop (double-width CAS), which is all that lock-free algorithms
+// use them for.
+template<class T, atomic_op Op, std::memory_order Order>
+constexpr bool valid_cell()
+{
+    if (sizeof(T) > 8 and Op != atomic_op::cas_loop)
+        return false;
+    if (Op == atomic_op::load)
+        return Order != std::memory_order_release and Order != std::memory_order_acq_rel;
+    if (Op == atomic_op::store)
+        return Order != std::memory_order_acquire and Order != std::memory_order_acq_rel;
+    return true;
+}
+
+template<class T, atomic_op Op, std::memory_order Order>
+inline void apply(std::atomic<T>& a, T& sink)
+{
+    if constexpr (Op == atomic_op::load)
+        sink += a.load(Order);
+    else if constexpr (Op == atomic_op::store)
+        a.store(++sink, Order);
+    else if constexpr (Op == atomic_op::exchange)
+        sink += a.exchange(sink, Order);
+    else if constexpr (Op == atomic_op::cas_loop)
+    {
+        T expected = a.load(std::memory_order_relaxed);
+        while (not a.compare_exchange_weak(expected, T(expected + 1), Order))
+            ;
+    }
+    else if constexpr (Op == atomic_op::fetch_or)
+        sink += a.fetch_or(1, Order);
+    else
+        sink += a.fetch_add(1, Order);
+}
+
+template<class T, atomic_op Op, std::memory_order Order>
+void run_cell()
+{
+    if constexpr (valid_cell<T, Op, Order>())
+        for (auto c : { contention::private_line, contention::shared_read, contention::shared_write })
+            for (int n : s_threads)
+            {
+                if (c == contention::private_line)
+                    n = 1;
+                else if (n < 2)
+                    continue;  // no other thread to contend with: that's the private row
+                cache_aligned<std::atomic<T>> line(T(0));
+                std::atomic<bool> done{false};
+                auto elapsed = run_threads(n, [&](int thread) {
+                    T sink = 0;
+                    if (thread == 0)
+                    {
+                        for (int i = 0; i < s_matrix_iterations; i++)
+                            apply<T, Op, Order>(*line, sink);
+                        done.store(true, std::memory_order_relaxed);
+                    }
+                    else if (c == contention::shared_read)
+                        while (not done.load(std::memory_order_relaxed))
+                            sink += line->load(std::memory_order_relaxed);
+                    else
+                        while (not done.load(std::memory_order_relaxed))
+                            line->store(++sink, std::memory_order_relaxed);
+                });
+                double ns = std::chrono::duration<double, std::nano>(elapsed).count() / s_matrix_iterations;
+                std::cout << name(Op) << "\t" << name(Order) << "\t" << 8 * sizeof(T) << "\t" << name(c) << "\t"
+                          << n << "\t" << ns << "\n";
+                record_sample(std::string(name(Op)) + " " + name(Order) + " " + std::to_string(8 * sizeof(T)) + " "
+                              + name(c) + " " + std::to_string(n), ns);
+                if (c == contention::private_line)
+                    break;
+            }
+}
+
+template<class T, atomic_op Op, std::size_t... M>
+void run_orders(std::index_sequence<M...>)
+{
+    (run_cell<T, Op, matrix_orders[M]>(), ...);
+}
+
+template<class T, std::size_t... O>
+void run_ops(std::index_sequence<O...>)
+{
+    (run_orders<T, matrix_ops[O]>(std::make_index_sequence<matrix_orders.size()>()), ...);
+}
+
+template<class... T>
+bool run_matrix()
+{
+    std::cout << "op\torder\tbits\tcontention\tthreads\tns/op\n";
+    (run_ops<T>(std::make_index_sequence<matrix_ops.size()>()), ...);
+    return true;
+}
+
+#ifdef HAVE_ATOMIC_128
+named_test s_atomic_matrix("atomic_matrix", []() {
+    return run_matrix<std::uint8_t, std::uint16_t, std::uint32_t, std::uint64_t, unsigned __int128>();
+});
+#else
+named_test s_atomic_matrix("atomic_matrix", []() {
+    return run_matrix<std::uint8_t, std::uint16_t, std::uint32_t, std::uint64_t>();
+});
+#endif
+
+template<shard_by By>
+struct sharded
+{
+    void op1(int)
+    {
+        X.add(1);
+    }
+    void op2(int)
+    {
+        X.add(-1);
+    }
+    bool eval(long n1, long n2)
+    {
+        return X.load() == n1 - n2;
+    }
+    sharded_counter<long, By> X;
+};
+
+using sharded_counter_cpu = sharded<shard_by::cpu>;
+REGISTER_TEST(sharded_counter_cpu);
+using sharded_counter_thread = sharded<shard_by::thread>;
+REGISTER_TEST(sharded_counter_thread);
+
+
+// Lazy initialisation: every op gets an object that is constructed on first use and adds a value from it to a
+// count of the thread's own. Construction takes a while, so the first ops of every run race with it.
+struct payload
+{
+    explicit payload(std::atomic<int>* constructions)
+    {
+        constructions->fetch_add(1);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    int value = 1;
+};
+
+template<class Getter>
+struct lazy_test
+{
+    void op1(int thread)
+    {
+        counts[thread % max_threads] += getter.get().value;
+    }
+    void op2(int thread)
+    {
+        op1(thread);
+    }
+    // A function-local static is only constructed in the first run, so later runs count no construction.
+    bool eval(long n1, long n2)
+    {
+        return counts.reduce(0L, std::plus<>()) == n1 + n2 and constructions <= 1;
+    }
+    static constexpr int max_threads = 256;
+    std::atomic<int> constructions{0};
+    Getter getter{&constructions};
+    per_thread<long> counts{max_threads};
+};
+
+struct lazy_getter
+{
+    explicit lazy_getter(std::atomic<int>* constructions) : p(constructions) {}
+    payload& get()
+    {
+        return p.get();
+    }
+    lazy<payload> p;
+};
+
+struct call_once_getter
+{
+    explicit call_once_getter(std::atomic<int>* constructions) : constructions(constructions) {}
+    payload& get()
+    {
+        std::call_once(once, [this] { p = std::make_unique<payload>(constructions); });
+        return *p;
+    }
+    std::atomic<int>* constructions;
+    std::once_flag once;
+    std::unique_ptr<payload> p;
+};
+
+struct static_local_getter
+{
+    explicit static_local_getter(std::atomic<int>* constructions) : constructions(constructions) {}
+    payload& get()
+    {
+        static payload p(constructions);
+        return p;
+    }
+    std::atomic<int>* constructions;
+};
+
+// Takes the mutex on every call.
+struct mutex_getter
+{
+    explicit mutex_getter(std::atomic<int>* constructions) : constructions(constructions) {}
+    payload& get()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (not p)
+            p = std::make_unique<payload>(constructions);
+        return *p;
+    }
+    std::atomic<int>* constructions;
+    std::mutex mtx;
+    std::unique_ptr<payload> p;
+};
+
+using lazy_get_lazy = lazy_test<lazy_getter>;
+REGISTER_TEST(lazy_get_lazy);
+using lazy_get_call_once = lazy_test<call_once_getter>;
+REGISTER_TEST(lazy_get_call_once);
+using lazy_get_static_local = lazy_test<static_local_getter>;
+REGISTER_TEST(lazy_get_static_local);
+using lazy_get_mutex = lazy_test<mutex_getter>;
+REGISTER_TEST(lazy_get_mutex);
+
+
+// Read-mostly state: every op reads a config that a background writer replaces every s_writer_period
+// microseconds, and checks that it didn't get a mix of two versions.
+named_option s_writer_period("writer-period-us", "Time between the writer's updates in the read-mostly tests", 100);
+
+struct config
+{
+    long version = 0;
+    long a = 0, b = 0, c = 0;
+};
+
+template<class Store>
+struct read_mostly_test
+{
+    read_mostly_test() : writer([this] {
+        for (long v = 1; not stop.load(std::memory_order_relaxed); v++)
+        {
+            store.write(config{ v, v, v, v });
+            std::this_thread::sleep_for(std::chrono::microseconds(s_writer_period));
+        }
+    }) {}
+    ~read_mostly_test()
+    {
+        stop = true;
+        writer.join();
+    }
+    void op1(int thread)
+    {
+        config c = store.read();
+        if (c.a != c.version or c.b != c.version or c.c != c.version)
+            torn[thread % max_threads]++;
+    }
+    void op2(int thread)
+    {
+        op1(thread);
+    }
+    bool eval(long, long)
+    {
+        return torn.reduce(0L, std::plus<>()) == 0;
+    }
+    static constexpr int max_threads = 256;
+    Store store;
+    per_thread<long> torn{max_threads};
+    std::atomic<bool> stop{false};
+    std::thread writer;
+};
+
+struct seqlock_store
+{
+    config read() const { return value.load(); }
+    void write(const config& c) { value.store(c); }
+    seqlock<config> value;
+};
+
+struct snapshot_store
+{
+    config read() const { return *value.read(); }
+    void write(const config& c) { value.store(c); }
+    snapshot<config> value;
+};
+
+struct shared_mutex_store
+{
+    config read() const
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        return value;
+    }
+    void write(const config& c)
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        value = c;
+    }
+    mutable std::shared_mutex mtx;
+    config value;
+};
+
+using read_mostly_seqlock = read_mostly_test<seqlock_store>;
+REGISTER_TEST(read_mostly_seqlock);
+using read_mostly_snapshot = read_mostly_test<snapshot_store>;
+REGISTER_TEST(read_mostly_snapshot);
+using read_mostly_shared_mutex = read_mostly_test<shared_mutex_store>;
+REGISTER_TEST(read_mostly_shared_mutex);
+
+
+named_option s_critical_section("critical-section", "Increments per critical section of the lock tests", 10);
+
+// Every op takes the lock and increments a shared counter s_critical_section times: any lost update means
+// the lock let two threads in at once.
+template<class Lock>
+struct lock_test
+{
+    void op1(int)
+    {
+        std::lock_guard<Lock> lock(m);
+        for (int i = 0; i < s_critical_section; i++)
+            X = X + 1;
+    }
+    void op2(int thread)
+    {
+        op1(thread);
+    }
+    bool eval(long n1, long n2)
+    {
+        return X == (n1 + n2) * s_critical_section;
+    }
+    Lock m;
+    volatile long X = 0;
+};
+
+using lock_std_mutex = lock_test<std::mutex>;
+REGISTER_TEST(lock_std_mutex);
+using lock_ttas_spinlock = lock_test<ttas_spinlock>;
+REGISTER_TEST(lock_ttas_spinlock);
+using lock_ticket = lock_test<ticket_lock>;
+REGISTER_TEST(lock_ticket);
+using lock_mcs = lock_test<mcs_lock>;
+REGISTER_TEST(lock_mcs);
+using lock_futex_mutex = lock_test<futex_mutex>;
+REGISTER_TEST(lock_futex_mutex);
@@ -0,0 +1,215 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "fifo.h"
+#include "stats.h"
+#include "topology.h"
+#include "trace.h"
+#include <memory>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+#include <sys/prctl.h>
+
+// Ordered parallel pipeline: serial input stage -> `width` parallel stages -> serial, ordered output stage.
+//
+// The caller is the serial input stage. It push()es tokens and calls next() at the end of every group of tokens.
+// Groups are dealt round-robin over `width` lanes, each running its own Stage instance on its own thread.
+// At the end of a group the lane hands Stage::flush() to the sink thread, which collects the lanes round-robin
+// again, so the sink sees the results in the order the groups were pushed.
+// At most Depth tokens per lane are in flight; push() blocks when the lane is full.
+//
+// A Stage provides:
+//     using input_t = ...;
+//     using output_t = ...;
+//     void operator()(input_t&&);   // consume one token of the current group
+//     output_t flush();             // end of group: return its result and prepare for the next one
+struct pipeline_config {
+    std::size_t width = 2;
+    const char* input_name = "input";
+    const char* stage_name = "stage";
+    const char* sink_name = "sink";
+    std::vector<int> stage_cpus;  // lane i is pinned to stage_cpus[i % size()]; unpinned when empty
+    int sink_cpu = -1;            // unpinned when negative
+    bool local_queues = false;    // allocate each lane's queues on the NUMA node of its CPU (first touch)
+    pipeline_stats* stats = nullptr; // where the threads and queues register their counters; private when null
+    tracer* trace = nullptr;         // record format/write spans and queue waits per thread; off when null
+};
+
+// Size in bytes of a stage result, for the statistics: anything with a size(), 0 otherwise.
+template<class T>
+auto output_size(const T& value, int) -> decltype(std::size_t(value.size())) { return value.size(); }
+template<class T>
+std::size_t output_size(const T&, long) { return 0; }
+
+template<class Stage, std::size_t Depth = 65536>
+class pipeline {
+public:
+    using stage_t = Stage;
+    using input_t = typename Stage::input_t;
+    using output_t = typename Stage::output_t;
+
+    template<class Sink, class... Args>
+    pipeline(const pipeline_config& config, Sink sink, const Args&... stage_args)
+        : own_stats(config.stats ? nullptr : std::make_unique<pipeline_stats>()),
+          stats(config.stats ? *config.stats : *own_stats),
+          input_counters(stats.add_thread(config.input_name)),
+          input_track(config.trace ? &config.trace->add_track(config.input_name) : nullptr) {
+        lanes.resize(config.width ? config.width : 1);
+        for (std::size_t i = 0; i < lanes.size(); i++) {
+            int cpu = config.stage_cpus.empty() ? -1 : config.stage_cpus[i % config.stage_cpus.size()];
+            {
+                cpu_binding binding(config.local_queues ? cpu : -1);
+                lanes[i] = std::make_unique<lane>(stats, config.trace, config.stage_name + std::to_string(i),
+                                                  stage_args...);
+            }
+            lane& l = *lanes[i];
+            l.thread = std::thread([&l, cpu, name = config.stage_name] {
+                prctl(PR_SET_NAME, name, nullptr, nullptr, nullptr);
+                if (cpu >= 0)
+                    pin_this_thread(cpu);
+                std::uint64_t group_begin = 0;
+                for (;;) {
+                    lane_input_t value = wait_pop(l.input, l.counters, l.track);
+                    thread_counters::add(l.input_queue.popped);
+                    if (auto token = std::get_if<input_t>(&value)) {
+                        if (l.track and not group_begin)
+                            group_begin = trace_track::now();
+                        l.stage(std::move(*token));
+                        thread_counters::add(l.counters.tokens);
+                    }
+                    else if (std::holds_alternative<group_end_t>(value)) {
+                        output_t result = l.stage.flush();
+                        if (l.track) {
+                            l.track->record("format", group_begin ? group_begin : trace_track::now(), trace_track::now());
+                            group_begin = 0;
+                        }
+                        thread_counters::add(l.counters.bytes, output_size(result, 0));
+                        wait_push(l.output, std::move(result), l.counters, l.track);
+                        thread_counters::add(l.output_queue.pushed);
+                        thread_counters::add(l.counters.groups);
+                    }
+                    else
+                        break;
+                }
+                l.output.push(done_t{});
+            });
+        }
+
+        sink_counters = &stats.add_thread(config.sink_name);
+        sink_track = config.trace ? &config.trace->add_track(config.sink_name) : nullptr;
+        sink_thread = std::thread([this, sink = std::move(sink), cpu = config.sink_cpu, name = config.sink_name]() mutable {
+            prctl(PR_SET_NAME, name, nullptr, nullptr, nullptr);
+            if (cpu >= 0)
+                pin_this_thread(cpu);
+            for (std::size_t i = 0;; i = (i + 1) % lanes.size()) {
+                lane_output_t value = wait_pop(lanes[i]->output, *sink_counters, sink_track);
+                auto result = std::get_if<output_t>(&value);
+                if (not result)
+                    break; // Groups are dealt round-robin, so the first lane to run dry is the end.
+                thread_counters::add(lanes[i]->output_queue.popped);
+                thread_counters::add(sink_counters->bytes, output_size(*result, 0));
+                {
+                    trace_span span(sink_track, "write");
+                    sink(std::move(*result));
+                }
+                thread_counters::add(sink_counters->groups);
+            }
+        });
+    }
+
+    ~pipeline() {
+        if (group_open)
+            next();
+        for (auto& l : lanes)
+            l->input.push(done_t{});
+        sink_thread.join();
+        for (auto& l : lanes)
+            l->thread.join();
+    }
+
+    pipeline(const pipeline&) = delete;
+    pipeline& operator=(const pipeline&) = delete;
+
+    void push(input_t&& token) {
+        put(lane_input_t(std::in_place_index<0>, std::move(token)));
+        thread_counters::add(input_counters.tokens);
+        group_open = true;
+    }
+
+    void next() {
+        put(group_end_t{});
+        thread_counters::add(input_counters.groups);
+        current = (current + 1) % lanes.size();
+        group_open = false;
+    }
+
+    std::size_t width() const {
+        return lanes.size();
+    }
+
+private:
+    struct group_end_t {};
+    struct done_t {};
+
+    using lane_input_t = std::variant<input_t, group_end_t, done_t>;
+    using lane_output_t = std::variant<output_t, done_t>;
+
+    struct lane {
+        template<class... Args>
+        lane(pipeline_stats& stats, tracer* trace, const std::string& name, const Args&... args)
+            : stage(args...),
+              counters(stats.add_thread(name)),
+              input_queue(stats.add_queue(name + ".in")),
+              output_queue(stats.add_queue(name + ".out")),
+              track(trace ? &trace->add_track(name) : nullptr) {}
+
+        Stage stage;
+        fifo<lane_input_t, Depth> input;
+        fifo<lane_output_t, Depth> output;
+        thread_counters& counters;
+        queue_counters& input_queue;
+        queue_counters& output_queue;
+        trace_track* track;
+        std::thread thread;
+    };
+
+    template<class Queue, class T>
+    static void wait_push(Queue& queue, T&& value, thread_counters& counters, trace_track* track) {
+        counters.set_state(thread_counters::in_push);
+        {
+            trace_span span(track, "push wait", true);
+            queue.push(std::move(value));
+        }
+        counters.set_state(thread_counters::running);
+    }
+
+    template<class Queue>
+    static auto wait_pop(Queue& queue, thread_counters& counters, trace_track* track) {
+        counters.set_state(thread_counters::in_pop);
+        trace_span span(track, "pop wait", true);
+        auto ret = queue.pop();
+        counters.set_state(thread_counters::running);
+        return ret;
+    }
+
+    void put(lane_input_t&& value) {
+        lane& l = *lanes[current];
+        wait_push(l.input, std::move(value), input_counters, input_track);
+        thread_counters::add(l.input_queue.pushed);
+    }
+
+    std::unique_ptr<pipeline_stats> own_stats;
+    pipeline_stats& stats;
+    thread_counters& input_counters;
+    trace_track* input_track;
+    thread_counters* sink_counters = nullptr;
+    trace_track* sink_track = nullptr;
+    std::vector<std::unique_ptr<lane>> lanes;
+    std::thread sink_thread;
+    std::size_t current = 0;
+    bool group_open = false;
+};
+
+#endif /* PIPELINE_H_ */
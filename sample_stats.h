@@ -0,0 +1,86 @@
+#ifndef SAMPLE_STATS_H_
+#define SAMPLE_STATS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+// Summary of repeated measurements of one quantity.
+struct sample_summary {
+    std::size_t n = 0;
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;  // sample standard deviation (n - 1)
+    double min = 0;
+    double p99 = 0;     // nearest rank
+};
+
+inline sample_summary summarize(std::vector<double> samples) {
+    sample_summary s;
+    s.n = samples.size();
+    if (samples.empty())
+        return s;
+    std::sort(samples.begin(), samples.end());
+    s.min = samples.front();
+    s.median = s.n % 2 ? samples[s.n / 2] : (samples[s.n / 2 - 1] + samples[s.n / 2]) / 2;
+    s.p99 = samples[std::size_t(std::ceil(0.99 * s.n)) - 1];
+    s.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / s.n;
+    double sq = 0;
+    for (double x : samples)
+        sq += (x - s.mean) * (x - s.mean);
+    s.stddev = s.n > 1 ? std::sqrt(sq / (s.n - 1)) : 0;
+    return s;
+}
+
+// Regularized incomplete beta function I_x(a, b), by its continued fraction (Lentz's method).
+inline double incomplete_beta(double a, double b, double x) {
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    if (x > (a + 1) / (a + b + 2))
+        return 1 - incomplete_beta(b, a, 1 - x);
+    const double tiny = 1e-300;
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log1p(-x)) / a;
+    double c = 1, d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (std::fabs(d) < tiny ? tiny : d);
+    double f = d;
+    for (int m = 1; m < 300; m++) {
+        for (int odd = 0; odd < 2; odd++) {
+            double num = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                             : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + num * d;
+            d = 1 / (std::fabs(d) < tiny ? tiny : d);
+            c = 1 + num / c;
+            c = std::fabs(c) < tiny ? tiny : c;
+            f *= c * d;
+        }
+        if (std::fabs(c * d - 1) < 1e-12)
+            break;
+    }
+    return front * f;
+}
+
+// P(T > t) for Student's t distribution with `df` degrees of freedom.
+inline double student_t_sf(double t, double df) {
+    double tail = 0.5 * incomplete_beta(df / 2, 0.5, df / (df + t * t));
+    return t > 0 ? tail : 1 - tail;
+}
+
+// One-sided Welch t-test of `now` being larger (slower) than `before`; returns the p-value.
+// Needs at least two samples on both sides, otherwise returns 1 (nothing can be concluded).
+inline double welch_p_larger(const sample_summary& before, const sample_summary& now) {
+    if (before.n < 2 or now.n < 2)
+        return 1;
+    double v0 = before.stddev * before.stddev / before.n;
+    double v1 = now.stddev * now.stddev / now.n;
+    if (v0 + v1 == 0)
+        return now.mean > before.mean ? 0 : 1;
+    double t = (now.mean - before.mean) / std::sqrt(v0 + v1);
+    double df = (v0 + v1) * (v0 + v1) / (v0 * v0 / (before.n - 1) + v1 * v1 / (now.n - 1));
+    return student_t_sf(t, df);
+}
+
+#endif /* SAMPLE_STATS_H_ */
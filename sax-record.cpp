@@ -0,0 +1,14 @@
+#include "sax_record.h"
+#include <iostream>
+
+// Records the SAX event stream of a JSON document (stdin) in the sax_record.h format (stdout).
+// Replay it with `impl3 --replay` to run the formatters without paying for parsing.
+int main() {
+    std::ios::sync_with_stdio(false);
+    sax_recorder recorder(std::cout);
+    if (not nlohmann::json::sax_parse(std::cin, &recorder)) {
+        std::cerr << "sax-record: failed to parse input\n";
+        return 1;
+    }
+    return 0;
+}
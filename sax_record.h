@@ -0,0 +1,203 @@
+#ifndef SAX_RECORD_H_
+#define SAX_RECORD_H_
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <nlohmann/json.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Compact binary recording of the nlohmann SAX event stream.
+//
+// A recording starts with sax_magic, followed by one opcode byte per event.
+// Integers and lengths are LEB128 varints (signed integers zigzag-encoded), floats are the raw
+// 8 bytes of the double followed by the length-prefixed lexeme, strings and keys are length-prefixed.
+
+constexpr char sax_magic[4] = { 'S', 'A', 'X', '1' };
+
+enum class sax_op : std::uint8_t {
+    null,
+    boolean_false,
+    boolean_true,
+    number_integer,
+    number_unsigned,
+    number_float,
+    string,
+    key,
+    start_object,
+    end_object,
+    start_array,
+    end_array,
+};
+
+// json_sax implementation that appends every event to an output stream.
+class sax_recorder : public nlohmann::json_sax<nlohmann::json> {
+public:
+    explicit sax_recorder(std::ostream& os) : m_os(os) {
+        m_buf.append(sax_magic, sizeof(sax_magic));
+    }
+
+    ~sax_recorder() {
+        flush();
+    }
+
+    void flush() {
+        m_os.write(m_buf.data(), m_buf.size());
+        m_buf.clear();
+    }
+
+    bool null()                                                   { return put(sax_op::null); }
+    bool boolean(bool val)                                        { return put(val ? sax_op::boolean_true : sax_op::boolean_false); }
+    bool number_integer(number_integer_t val)                     { put(sax_op::number_integer); return put_zigzag(val); }
+    bool number_unsigned(number_unsigned_t val)                   { put(sax_op::number_unsigned); return put_varint(val); }
+    bool number_float(number_float_t val, const string_t& lexeme) { put(sax_op::number_float); put_raw(val); return put_string(lexeme); }
+    bool string(string_t& val)                                    { put(sax_op::string); return put_string(val); }
+    bool binary(binary_t&)                                        { return true; }
+
+    bool start_object(std::size_t n) { put(sax_op::start_object); return put_varint(n); }
+    bool end_object()                { return put(sax_op::end_object); }
+    bool start_array(std::size_t n)  { put(sax_op::start_array); return put_varint(n); }
+    bool end_array()                 { return put(sax_op::end_array); }
+
+    bool key(string_t& val) { put(sax_op::key); return put_string(val); }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) { return false; }
+
+private:
+    static constexpr std::size_t flush_threshold = 1 << 20;
+
+    bool put(sax_op value) {
+        if (m_buf.size() >= flush_threshold)
+            flush();
+        m_buf.push_back(static_cast<char>(value));
+        return true;
+    }
+
+    bool put_varint(std::uint64_t value) {
+        while (value >= 0x80) {
+            m_buf.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        m_buf.push_back(static_cast<char>(value));
+        return true;
+    }
+
+    bool put_zigzag(std::int64_t value) {
+        return put_varint((static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+    }
+
+    bool put_raw(double value) {
+        m_buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        return true;
+    }
+
+    bool put_string(const std::string& value) {
+        put_varint(value.size());
+        m_buf.append(value);
+        return true;
+    }
+
+    std::ostream& m_os;
+    std::string m_buf;
+};
+
+// A complete recording in memory: mapped when the input is a regular file, read otherwise.
+class sax_recording {
+public:
+    explicit sax_recording(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_map = static_cast<const char*>(p);
+                m_size = st.st_size;
+                return;
+            }
+        }
+        char chunk[1 << 16];
+        for (ssize_t n; (n = read(fd, chunk, sizeof(chunk))) > 0;)
+            m_buf.append(chunk, n);
+    }
+
+    ~sax_recording() {
+        if (m_map)
+            munmap(const_cast<char*>(m_map), m_size);
+    }
+
+    sax_recording(const sax_recording&) = delete;
+    sax_recording& operator=(const sax_recording&) = delete;
+
+    const char* begin() const { return m_map ? m_map : m_buf.data(); }
+    const char* end() const { return begin() + (m_map ? m_size : m_buf.size()); }
+
+private:
+    const char* m_map = nullptr;
+    std::size_t m_size = 0;
+    std::string m_buf;
+};
+
+// Feed a recording into any json_sax-compatible handler.
+// Returns false when the recording is malformed (including unbalanced start and end events, which handlers
+// may rely on the parser never to send) or the handler asks to stop.
+template<class SAX>
+bool sax_replay(const char* p, const char* end, SAX* sax) {
+    auto get_varint = [&](std::uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; p != end and shift < 64; shift += 7) {
+            std::uint8_t b = *p++;
+            value |= std::uint64_t(b & 0x7f) << shift;
+            if (not (b & 0x80))
+                return true;
+        }
+        return false;
+    };
+    std::string s;
+    auto get_string = [&]() {
+        std::uint64_t n;
+        if (not get_varint(n) or n > std::uint64_t(end - p))
+            return false;
+        s.assign(p, n);
+        p += n;
+        return true;
+    };
+
+    if (end - p < std::ptrdiff_t(sizeof(sax_magic)) or std::memcmp(p, sax_magic, sizeof(sax_magic)))
+        return false;
+    p += sizeof(sax_magic);
+
+    std::uint64_t u;
+    double d;
+    std::size_t depth = 0;
+    while (p != end) {
+        bool ok = false;
+        switch (static_cast<sax_op>(*p++)) {
+        case sax_op::null:            ok = sax->null(); break;
+        case sax_op::boolean_false:   ok = sax->boolean(false); break;
+        case sax_op::boolean_true:    ok = sax->boolean(true); break;
+        case sax_op::number_integer:  ok = get_varint(u) and sax->number_integer(std::int64_t(u >> 1) ^ -std::int64_t(u & 1)); break;
+        case sax_op::number_unsigned: ok = get_varint(u) and sax->number_unsigned(u); break;
+        case sax_op::number_float:
+            if (end - p < std::ptrdiff_t(sizeof(d)))
+                return false;
+            std::memcpy(&d, p, sizeof(d));
+            p += sizeof(d);
+            ok = get_string() and sax->number_float(d, s);
+            break;
+        case sax_op::string:          ok = get_string() and sax->string(s); break;
+        case sax_op::key:             ok = get_string() and sax->key(s); break;
+        case sax_op::start_object:    ok = get_varint(u) and sax->start_object(u); depth++; break;
+        case sax_op::end_object:      ok = depth-- > 0 and sax->end_object(); break;
+        case sax_op::start_array:     ok = get_varint(u) and sax->start_array(u); depth++; break;
+        case sax_op::end_array:       ok = depth-- > 0 and sax->end_array(); break;
+        default:                      break;
+        }
+        if (not ok)
+            return false;
+    }
+    return depth == 0;
+}
+
+#endif /* SAX_RECORD_H_ */
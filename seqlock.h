@@ -0,0 +1,72 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include "locks.h"
+
+// A small trivially copyable T that is read far more often than written. Readers never write shared memory:
+// they copy the value and retry if a writer was active meanwhile, which the sequence number tells (odd
+// while a write is in progress). Writers are serialised by a spinlock, so they should be rare and short.
+// The value is kept in relaxed atomic words, so the copies readers make of a value being written are races
+// only in the intended sense.
+template<class T>
+class seqlock {
+    static_assert(std::is_trivially_copyable_v<T>, "seqlock copies T as raw words");
+
+public:
+    explicit seqlock(const T& value = T()) {
+        write_words(value);
+    }
+
+    T load() const {
+        word copy[words];
+        backoff wait;
+        for (;;) {
+            unsigned s = seq.load(std::memory_order_acquire);
+            if (s & 1) {
+                wait();
+                continue;
+            }
+            for (std::size_t i = 0; i < words; i++)
+                copy[i] = data[i].load(std::memory_order_relaxed);
+            // The copy must be complete before we check that nobody wrote meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s)
+                break;
+        }
+        T value;
+        std::memcpy(&value, copy, sizeof(T));
+        return value;
+    }
+
+    void store(const T& value) {
+        std::lock_guard<ttas_spinlock> lock(writer);
+        unsigned s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        // Readers that see any of the new words must see the odd sequence number.
+        std::atomic_thread_fence(std::memory_order_release);
+        write_words(value);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+private:
+    using word = std::uintptr_t;
+    static constexpr std::size_t words = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+
+    void write_words(const T& value) {
+        word copy[words] = {};
+        std::memcpy(copy, &value, sizeof(T));
+        for (std::size_t i = 0; i < words; i++)
+            data[i].store(copy[i], std::memory_order_relaxed);
+    }
+
+    std::atomic<unsigned> seq{0};
+    std::atomic<word> data[words];
+    ttas_spinlock writer;
+};
+
+#endif /* SEQLOCK_H_ */
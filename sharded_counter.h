@@ -0,0 +1,78 @@
+#ifndef SHARDED_COUNTER_H_
+#define SHARDED_COUNTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <sched.h>
+#include "cache_aligned.h"
+
+// A counter on a cache line of its own.
+template<class T>
+struct alignas(cache_line_size) counter_slot {
+    // Safe with any number of writers.
+    void add(T n) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Only for slots with a single writer: a plain load and store, no locked instruction.
+    void add_single_writer(T n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    T load() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<T> value{0};
+};
+
+enum class shard_by {
+    cpu,     // the CPU the thread is running on (sched_getcpu(), served from the vDSO or rseq)
+    thread,  // a number handed out to every thread on its first increment
+};
+
+inline std::atomic<unsigned> s_next_thread_index{0};
+
+inline unsigned this_thread_index() {
+    thread_local unsigned index = s_next_thread_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// Counter for many writers: every CPU (or thread) increments a slot of its own, so increments don't bounce
+// a shared cache line between cores; reading sums all slots. Slots can still be shared (threads migrate,
+// or outnumber the slots), so increments stay atomic, but they are uncontended and thus cheap.
+// Reads are not a snapshot: increments that happen during a read may or may not be included.
+template<class T, shard_by By = shard_by::cpu>
+class sharded_counter {
+public:
+    explicit sharded_counter(unsigned shards = std::max(1u, std::thread::hardware_concurrency()))
+        : shards(shards), slots(new counter_slot<T>[shards]) {}
+
+    void add(T n = 1) {
+        slots[shard() % shards].add(n);
+    }
+
+    T load() const {
+        T sum = 0;
+        for (unsigned i = 0; i < shards; i++)
+            sum += slots[i].load();
+        return sum;
+    }
+
+private:
+    static unsigned shard() {
+        if constexpr (By == shard_by::cpu) {
+            int cpu = sched_getcpu();
+            return cpu < 0 ? 0 : cpu;
+        }
+        else
+            return this_thread_index();
+    }
+
+    unsigned shards;
+    std::unique_ptr<counter_slot<T>[]> slots;
+};
+
+#endif /* SHARDED_COUNTER_H_ */
@@ -22,6 +22,7 @@ public:
             else {
                 std::cout << "someone else is doing it\n";
             }
+            p = instance.get();
         }
         return *p;
     }
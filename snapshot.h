@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include "epoch.h"
+
+// Read-copy-update of a T of any size: readers get the current version without locking and keep using it
+// for as long as they hold the reader, even if it's replaced meanwhile; writers publish a new version with
+// a pointer swap and retire the old one, which epoch_retire frees once no reader can still see it.
+// Writers are serialised among themselves, and flush the epoch domain after every write, as they are expected
+// to be rare: otherwise old versions would wait for a batch of retirements. There must be no readers left
+// when the snapshot is destroyed.
+template<class T>
+class snapshot {
+public:
+    template<class... Args>
+    explicit snapshot(Args&&... args) : current(new T(std::forward<Args>(args)...)) {}
+
+    snapshot(const snapshot&) = delete;
+    snapshot& operator=(const snapshot&) = delete;
+
+    ~snapshot() {
+        delete current.load(std::memory_order_relaxed);
+    }
+
+    // The version that was current when the reader was made.
+    class reader {
+    public:
+        explicit reader(const std::atomic<T*>& current) : p(current.load(std::memory_order_acquire)) {}
+
+        const T& operator*() const { return *p; }
+        const T* operator->() const { return p; }
+
+    private:
+        epoch_guard guard;  // pins before p is loaded
+        const T* p;
+    };
+
+    reader read() const {
+        return reader(current);
+    }
+
+    void store(T value) {
+        {
+            std::lock_guard<std::mutex> lock(writer);
+            epoch_retire(current.exchange(new T(std::move(value)), std::memory_order_acq_rel));
+        }
+        epoch_domain::global().flush();
+    }
+
+    // Publishes a copy of the current version modified by f(T&).
+    template<class F>
+    void update(F f) {
+        {
+            std::lock_guard<std::mutex> lock(writer);
+            T* next = new T(*current.load(std::memory_order_relaxed));
+            f(*next);
+            epoch_retire(current.exchange(next, std::memory_order_acq_rel));
+        }
+        epoch_domain::global().flush();
+    }
+
+private:
+    std::atomic<T*> current;
+    std::mutex writer;
+};
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,42 @@
+#ifndef SPIN_BARRIER_H_
+#define SPIN_BARRIER_H_
+
+#include <atomic>
+#include <thread>
+#include "cache_aligned.h"
+#include "locks.h"
+
+// Reusable barrier for a fixed number of threads that spins instead of sleeping, so all threads leave it
+// within a few hundred cycles of the last one arriving.
+// Sense-reversing: the last thread to arrive resets the count and flips the shared sense, which the others
+// are waiting for, so the barrier can be entered again right away. Every thread keeps its own sense,
+// initially false, and passes it to every wait().
+class spin_barrier {
+public:
+    explicit spin_barrier(int threads) : threads(threads), waiting(threads) {}
+
+    void wait(bool& local_sense) {
+        local_sense = not local_sense;
+        if (waiting.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            waiting.store(threads, std::memory_order_relaxed);
+            sense.store(local_sense, std::memory_order_release);
+            return;
+        }
+        // Spin tightly for the short waits that matter, but don't starve the threads we wait for when they
+        // share our core.
+        for (unsigned spins = 0; sense.load(std::memory_order_acquire) != local_sense; spins++)
+            if (spins < max_spins)
+                cpu_relax();
+            else
+                std::this_thread::yield();
+    }
+
+private:
+    static constexpr unsigned max_spins = 4096;
+
+    const int threads;
+    alignas(cache_line_size) std::atomic<int> waiting;
+    alignas(cache_line_size) std::atomic<bool> sense{false};
+};
+
+#endif /* SPIN_BARRIER_H_ */
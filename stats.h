@@ -0,0 +1,184 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <sys/prctl.h>
+#include "sharded_counter.h"
+
+// Per-thread pipeline counters.
+// Every counter has exactly one writer, which updates it with a relaxed load and store (no read-modify-write),
+// and lives on a cache line of its own: these are the slots of a sharded_counter sharded by thread, except that
+// they are reported per thread instead of summed. Readers (the sampler, the final report)
+// only ever read them, so counting adds no shared cache line writes to the hot path.
+struct thread_counters {
+    enum state_t { running, in_push, in_pop, num_states };
+
+    explicit thread_counters(std::string name) : name(std::move(name)) {}
+
+    using counter_t = counter_slot<std::uint64_t>;
+
+    static void add(counter_t& counter, std::uint64_t n = 1) {
+        counter.add_single_writer(n);
+    }
+
+    void set_state(state_t s) {
+        state.store(s, std::memory_order_relaxed);
+    }
+
+    counter_t tokens;
+    counter_t groups;
+    counter_t bytes;
+    alignas(cache_line_size) std::atomic<int> state{running};
+
+    // Owned by the sampler.
+    alignas(cache_line_size) std::uint64_t state_samples[num_states] = {};
+    std::string name;
+};
+
+// Occupancy of one queue, derived from a producer-owned and a consumer-owned counter.
+struct queue_counters {
+    explicit queue_counters(std::string name) : name(std::move(name)) {}
+
+    std::uint64_t size() const {
+        std::uint64_t out = popped.load();
+        std::uint64_t in = pushed.load();
+        return in > out ? in - out : 0;
+    }
+
+    thread_counters::counter_t pushed;
+    thread_counters::counter_t popped;
+
+    // Owned by the sampler.
+    alignas(cache_line_size) std::uint64_t samples = 0;
+    std::uint64_t occupancy_sum = 0;
+    std::uint64_t occupancy_max = 0;
+    std::string name;
+};
+
+class pipeline_stats {
+public:
+    thread_counters& add_thread(std::string name) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return threads.emplace_back(std::move(name));
+    }
+
+    queue_counters& add_queue(std::string name) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return queues.emplace_back(std::move(name));
+    }
+
+    // Record which state every thread is in and how full every queue is.
+    void sample() {
+        std::lock_guard<std::mutex> lock(mtx);
+        samples++;
+        for (auto& t : threads)
+            t.state_samples[t.state.load(std::memory_order_relaxed)]++;
+        for (auto& q : queues) {
+            std::uint64_t n = q.size();
+            q.samples++;
+            q.occupancy_sum += n;
+            q.occupancy_max = std::max(q.occupancy_max, n);
+        }
+    }
+
+    // Time blocked in push/pop is estimated from the fraction of samples a thread spent in that state.
+    void report(std::ostream& os, bool json, double seconds) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto blocked = [&](const thread_counters& t, int state) {
+            return samples ? seconds * t.state_samples[state] / samples : 0.0;
+        };
+        auto average = [](const queue_counters& q) {
+            return q.samples ? double(q.occupancy_sum) / q.samples : 0.0;
+        };
+        if (json) {
+            os << "{\"seconds\":" << seconds << ",\"samples\":" << samples << ",\"threads\":[";
+            const char* sep = "";
+            for (const auto& t : threads) {
+                os << sep << "{\"name\":\"" << t.name << "\",\"tokens\":" << t.tokens.load() << ",\"groups\":" << t.groups.load()
+                   << ",\"bytes\":" << t.bytes.load() << ",\"push_blocked_seconds\":" << blocked(t, thread_counters::in_push)
+                   << ",\"pop_blocked_seconds\":" << blocked(t, thread_counters::in_pop) << "}";
+                sep = ",";
+            }
+            os << "],\"queues\":[";
+            sep = "";
+            for (const auto& q : queues) {
+                os << sep << "{\"name\":\"" << q.name << "\",\"pushed\":" << q.pushed.load() << ",\"average\":" << average(q)
+                   << ",\"max\":" << q.occupancy_max << "}";
+                sep = ",";
+            }
+            os << "]}\n";
+            return;
+        }
+        os << "pipeline statistics after " << std::fixed << std::setprecision(3) << seconds << " s ("
+           << samples << " samples)\n"
+           << std::setw(14) << std::left << "thread" << std::right << std::setw(14) << "tokens"
+           << std::setw(12) << "groups" << std::setw(14) << "bytes"
+           << std::setw(13) << "push wait s" << std::setw(13) << "pop wait s" << "\n";
+        for (const auto& t : threads)
+            os << std::setw(14) << std::left << t.name << std::right << std::setw(14) << t.tokens.load()
+               << std::setw(12) << t.groups.load() << std::setw(14) << t.bytes.load()
+               << std::setw(13) << blocked(t, thread_counters::in_push)
+               << std::setw(13) << blocked(t, thread_counters::in_pop) << "\n";
+        os << std::setw(14) << std::left << "queue" << std::right << std::setw(14) << "pushed"
+           << std::setw(12) << "avg size" << std::setw(14) << "max size" << "\n";
+        for (const auto& q : queues)
+            os << std::setw(14) << std::left << q.name << std::right << std::setw(14) << q.pushed.load()
+               << std::setw(12) << std::setprecision(1) << average(q) << std::setw(14) << q.occupancy_max
+               << std::setprecision(3) << "\n";
+        os.unsetf(std::ios::fixed);
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::deque<thread_counters> threads;
+    std::deque<queue_counters> queues;
+    std::uint64_t samples = 0;
+};
+
+inline std::atomic<bool> s_stats_dump_requested{false};
+
+// Samples a pipeline_stats periodically and reports it on SIGUSR1 and on destruction.
+class stats_monitor {
+public:
+    stats_monitor(pipeline_stats& stats, std::ostream& os, bool json,
+                  std::chrono::microseconds period = std::chrono::milliseconds(1))
+        : t0(std::chrono::steady_clock::now()) {
+        std::signal(SIGUSR1, [](int) { s_stats_dump_requested = true; });
+        thread = std::thread([this, &stats, &os, json, period] {
+            prctl(PR_SET_NAME, "stats", nullptr, nullptr, nullptr);
+            while (not stop.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(period);
+                stats.sample();
+                if (s_stats_dump_requested.exchange(false))
+                    stats.report(os, json, elapsed());
+            }
+            stats.report(os, json, elapsed());
+        });
+    }
+
+    ~stats_monitor() {
+        stop = true;
+        thread.join();
+    }
+
+private:
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    std::chrono::steady_clock::time_point t0;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+};
+
+#endif /* STATS_H_ */
@@ -1,11 +1,21 @@
 #ifndef TEST_MAIN_H_
 #define TEST_MAIN_H_
 
+#include "perf_counters.h"
+#include "sample_stats.h"
+#include <algorithm>
 #include <map>
 #include <string>
 #include <functional>
+#include <memory>
 #include <iostream>
 #include <cstring>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 struct named_test
 {
@@ -18,25 +28,233 @@ struct named_test
 };
 
 std::map<std::string, std::function<bool()>> named_test::s_register;
+
+// Integer parameter of some tests, set on the command line with --name value.
+struct named_option
+{
+    named_option(std::string name, std::string help, int value) : m_name("--" + name), m_help(help), m_value(value)
+    {
+        s_register[m_name] = this;
+    }
+    ~named_option() { s_register.erase(m_name); }
+
+    operator int() const { return m_value; }
+
+    std::string m_name;
+    std::string m_help;
+    int m_value;
+    static std::map<std::string, named_option*> s_register;
+};
+
+std::map<std::string, named_option*> named_option::s_register;
 int s_iterations = 100000000;
+// Programs may define DEFAULT_THREADS (e.g. "2, 8") before including this file to sweep more by default.
+#ifndef DEFAULT_THREADS
+#define DEFAULT_THREADS 2
+#endif
+std::vector<int> s_threads = { DEFAULT_THREADS };  // thread counts to sweep, for tests that run on several threads
+std::string s_ops = "12";             // thread i runs operation s_ops[i % s_ops.size()]
+bool s_perf = false;                  // count cycles, cache misses etc. of every test
+int s_warmup = 0;                     // runs of every test before the measured ones
+int s_repeat = 1;                     // measured runs of every test
+double s_alpha = 0.05;                // significance level of the comparison with a baseline
+
+// Measurements of one quantity of one test, one value per measured run. Lower is better.
+struct sample_series
+{
+    std::string test;
+    std::string series;
+    std::string unit;
+    std::vector<double> values;
+};
+
+std::vector<sample_series> s_results;
+std::map<std::pair<std::string, std::string>, sample_summary> s_baseline;
+std::string s_current_test;
+bool s_recording = false;
+int s_samples_recorded = 0;
+
+// Called by tests to report a measurement. Tests that don't report any are measured by their wall time.
+void record_sample(const std::string& series, double value, const char* unit = "ns/op")
+{
+    s_samples_recorded++;
+    if (not s_recording)
+        return;
+    for (auto& r : s_results)
+        if (r.test == s_current_test and r.series == series)
+            return r.values.push_back(value);
+    s_results.push_back({ s_current_test, series, unit, { value } });
+}
+
+// Results are stored as CSV with a header line, one line per series:
+//     test,series,unit,n,median,mean,stddev,min,p99
+void write_csv(std::ostream& os)
+{
+    os << "test,series,unit,n,median,mean,stddev,min,p99\n";
+    for (const auto& r : s_results)
+    {
+        sample_summary s = summarize(r.values);
+        os << r.test << "," << r.series << "," << r.unit << "," << s.n << "," << s.median << "," << s.mean << ","
+           << s.stddev << "," << s.min << "," << s.p99 << "\n";
+    }
+}
+
+void write_json(std::ostream& os)
+{
+    os << "[\n";
+    for (std::size_t i = 0; i < s_results.size(); i++)
+    {
+        const auto& r = s_results[i];
+        sample_summary s = summarize(r.values);
+        os << "  {\"test\":\"" << r.test << "\",\"series\":\"" << r.series << "\",\"unit\":\"" << r.unit
+           << "\",\"n\":" << s.n << ",\"median\":" << s.median << ",\"mean\":" << s.mean << ",\"stddev\":" << s.stddev
+           << ",\"min\":" << s.min << ",\"p99\":" << s.p99 << ",\"samples\":[";
+        for (std::size_t j = 0; j < r.values.size(); j++)
+            os << (j ? "," : "") << r.values[j];
+        os << "]}" << (i + 1 < s_results.size() ? ",\n" : "\n");
+    }
+    os << "]\n";
+}
+
+bool read_baseline(const char* file)
+{
+    std::ifstream is(file);
+    std::string line;
+    if (not std::getline(is, line))
+        return false;
+    while (std::getline(is, line))
+    {
+        std::vector<std::string> f;
+        std::istringstream ls(line);
+        for (std::string field; std::getline(ls, field, ',');)
+            f.push_back(field);
+        if (f.size() != 9)
+            return false;
+        sample_summary& s = s_baseline[{ f[0], f[1] }];
+        s.n = std::stoul(f[3]);
+        s.median = std::stod(f[4]);
+        s.mean = std::stod(f[5]);
+        s.stddev = std::stod(f[6]);
+        s.min = std::stod(f[7]);
+        s.p99 = std::stod(f[8]);
+    }
+    return true;
+}
+
+// Prints the statistics of every series of `test`; returns false when one is significantly slower than its baseline.
+bool report_series(const std::string& test)
+{
+    bool ok = true;
+    for (const auto& r : s_results)
+    {
+        if (r.test != test)
+            continue;
+        sample_summary s = summarize(r.values);
+        std::cout << "  " << r.series << " [" << r.unit << "]: median " << s.median << ", mean " << s.mean
+                  << ", stddev " << s.stddev << ", min " << s.min << ", p99 " << s.p99 << " (" << s.n << " runs)\n";
+        auto it = s_baseline.find({ r.test, r.series });
+        if (it == s_baseline.end())
+            continue;
+        const sample_summary& b = it->second;
+        double p = welch_p_larger(b, s);
+        bool slower = p < s_alpha;
+        std::cout << (slower ? "\e[31m" : "") << "    vs. baseline: mean " << b.mean << " -> " << s.mean << " ("
+                  << std::showpos << 100 * (s.mean / b.mean - 1) << std::noshowpos << "%), p = " << p
+                  << (slower ? ", significantly slower\e[39m" : "") << "\n";
+        ok = ok and not slower;
+    }
+    return ok;
+}
+
+// Number of the operation (1, 2, ...) that thread `i` runs.
+int op_of_thread(std::size_t i)
+{
+    return s_ops[i % s_ops.size()] - '0';
+}
+
+// Runs f(i) on `n` threads. They all spin at a start barrier until the last one is up, so the time returned
+// covers the work only, not creating the threads.
+template<class F>
+std::chrono::nanoseconds run_threads(int n, F&& f)
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++)
+        threads.emplace_back([&, i]() {
+            ready.fetch_add(1);
+            while (not go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            f(i);
+        });
+    while (ready.load() != n)
+        std::this_thread::yield();
+    auto t0 = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : threads)
+        t.join();
+    return std::chrono::steady_clock::now() - t0;
+}
 
 int main(int argc, const char** argv)
 {
     const char* prog_name = argv[0];
+    std::string default_threads;
+    for (int n : s_threads)
+        default_threads += (default_threads.empty() ? "" : ",") + std::to_string(n);
     auto usage = [&]() {
         std::cerr << "Usage: " << prog_name << " [option*] [test*]\n"
                 << "Options are:\n"
                 << "  -h|--help       Display this help message\n"
                 << "  -i|--iterations Number of iterations to perform per test\n"
                 << "  -a|--all        Run all tests\n"
-                << "Tests are:\n";
+                << "  -t|--threads    Comma-separated thread counts to run multi-threaded tests with (default "
+                << default_threads << ")\n"
+                << "  -o|--ops        Operation (1 or 2) of every thread, repeated over the threads (default 12: op1, op2, op1, ...)\n"
+                << "  --perf          Report hardware performance counters of every test\n"
+                << "  -w|--warmup     Number of unmeasured runs of every test (default 0)\n"
+                << "  -r|--repeat     Number of measured runs of every test (default 1)\n"
+                << "  --csv file      Write the statistics of all measurements to file as CSV\n"
+                << "  --json file     Write the statistics and samples of all measurements to file as JSON\n"
+                << "  --baseline file Compare with the CSV of an earlier run, failing tests that are significantly slower\n"
+                << "                  (one-sided Welch t-test)\n"
+                << "  --alpha p       Significance level of the baseline comparison (default 0.05)\n";
+        for (const auto& e : named_option::s_register)
+            std::cerr << "  " << e.first << " n" << std::string(e.first.size() < 14 ? 14 - e.first.size() : 1, ' ')
+                      << e.second->m_help << " (default " << e.second->m_value << ")\n";
+        std::cerr << "Tests are:\n";
         for (const auto& e : named_test::s_register)
             std::cout << "  " << e.first << "\n";
         return 0;
     };
     auto runtest = [&](auto&& e) {
         std::cerr << "Running " << e.first << "...\n";
-        bool success = e.second();
+        s_current_test = e.first;
+        std::unique_ptr<perf_counters> counters;
+        bool success = true;
+        for (int i = 0; i < s_warmup + s_repeat; i++)
+        {
+            s_recording = i >= s_warmup;
+            if (s_perf and i == s_warmup)  // count the recorded runs only, like the samples
+            {
+                counters = std::make_unique<perf_counters>();
+                counters->start();
+            }
+            int recorded = s_samples_recorded;
+            auto t0 = std::chrono::steady_clock::now();
+            success = e.second() and success;
+            auto t1 = std::chrono::steady_clock::now();
+            if (s_samples_recorded == recorded)
+                record_sample("wall", std::chrono::duration<double, std::milli>(t1 - t0).count(), "ms");
+        }
+        s_recording = false;
+        if (counters)
+        {
+            counters->stop();
+            counters->report(std::cout);
+        }
+        if (s_repeat > 1 or not s_baseline.empty())
+            success = report_series(e.first) and success;
         if (success)
             std::cerr << "\e[32m[PASS]  " << e.first << "\e[39m\n";
         else
@@ -45,6 +263,8 @@ int main(int argc, const char** argv)
     };
     if (argc <= 1) return usage();
     int ret = 0;
+    const char* csv_file = nullptr;
+    const char* json_file = nullptr;
     while (++argv, --argc)
     {
         if (not std::strcmp(argv[0], "-h") or not std::strcmp(argv[0], "--help"))
@@ -56,11 +276,71 @@ int main(int argc, const char** argv)
             if (not (++argv, --argc)) return usage();
             s_iterations = std::atoi(argv[0]);
         }
+        else if (not std::strcmp(argv[0], "-t") or not std::strcmp(argv[0], "--threads"))
+        {
+            if (not (++argv, --argc)) return usage();
+            s_threads.clear();
+            std::istringstream is(argv[0]);
+            for (std::string n; std::getline(is, n, ',');)
+                if (std::atoi(n.c_str()) > 0)
+                    s_threads.push_back(std::atoi(n.c_str()));
+            if (s_threads.empty()) return usage();
+        }
+        else if (not std::strcmp(argv[0], "-o") or not std::strcmp(argv[0], "--ops"))
+        {
+            if (not (++argv, --argc) or not *argv[0]) return usage();
+            if (std::strspn(argv[0], "12") != std::strlen(argv[0])) return usage();
+            s_ops = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--perf"))
+        {
+            s_perf = true;
+        }
+        else if (not std::strcmp(argv[0], "-w") or not std::strcmp(argv[0], "--warmup"))
+        {
+            if (not (++argv, --argc)) return usage();
+            s_warmup = std::max(0, std::atoi(argv[0]));
+        }
+        else if (not std::strcmp(argv[0], "-r") or not std::strcmp(argv[0], "--repeat"))
+        {
+            if (not (++argv, --argc)) return usage();
+            s_repeat = std::max(1, std::atoi(argv[0]));
+        }
+        else if (not std::strcmp(argv[0], "--csv"))
+        {
+            if (not (++argv, --argc)) return usage();
+            csv_file = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--json"))
+        {
+            if (not (++argv, --argc)) return usage();
+            json_file = argv[0];
+        }
+        else if (not std::strcmp(argv[0], "--baseline"))
+        {
+            if (not (++argv, --argc)) return usage();
+            if (not read_baseline(argv[0]))
+            {
+                std::cerr << prog_name << ": cannot read baseline " << argv[0] << "\n";
+                return -1;
+            }
+        }
+        else if (not std::strcmp(argv[0], "--alpha"))
+        {
+            if (not (++argv, --argc)) return usage();
+            s_alpha = std::atof(argv[0]);
+        }
         else if (not std::strcmp(argv[0], "-a") or not std::strcmp(argv[0], "--all"))
         {
             for (auto& e : named_test::s_register)
                 ret |= runtest(e);
         }
+        else if (named_option::s_register.count(argv[0]))
+        {
+            named_option* option = named_option::s_register[argv[0]];
+            if (not (++argv, --argc)) return usage();
+            option->m_value = std::atoi(argv[0]);
+        }
         else
         {
             auto it = named_test::s_register.find(argv[0]);
@@ -68,6 +348,16 @@ int main(int argc, const char** argv)
             ret |= runtest(*it);
         }
     }
+    if (csv_file)
+    {
+        std::ofstream os(csv_file);
+        write_csv(os);
+    }
+    if (json_file)
+    {
+        std::ofstream os(json_file);
+        write_json(os);
+    }
     return ret;
 }
 
@@ -0,0 +1,104 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+// CPU topology as exposed by sysfs, restricted to the CPUs this process may run on.
+struct cpu_info {
+    int cpu;
+    int core;     // topology/core_id, unique within a package
+    int package;  // topology/physical_package_id
+    int node;     // NUMA node, 0 when the kernel has no NUMA support
+};
+
+inline int read_sysfs_int(const std::string& path, int fallback) {
+    std::ifstream is(path);
+    int value;
+    return is >> value ? value : fallback;
+}
+
+inline std::vector<cpu_info> read_cpu_topology() {
+    std::vector<cpu_info> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (not CPU_ISSET(cpu, &allowed))
+            continue;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        cpu_info info{ cpu,
+                       read_sysfs_int(dir + "/topology/core_id", cpu),
+                       read_sysfs_int(dir + "/topology/physical_package_id", 0),
+                       0 };
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* e = readdir(d))
+                if (not std::string(e->d_name).compare(0, 4, "node"))
+                    info.node = std::atoi(e->d_name + 4);
+            closedir(d);
+        }
+        cpus.push_back(info);
+    }
+    return cpus;
+}
+
+// Order the allowed CPUs so that consecutive threads land on different physical cores for as long as possible:
+// first one hardware thread of every core (package by package), then their SMT siblings.
+inline std::vector<int> spread_cpus() {
+    std::vector<cpu_info> cpus = read_cpu_topology();
+    std::vector<std::tuple<int, int, int, int>> order; // sibling rank, package, core, cpu
+    for (const auto& c : cpus) {
+        int rank = std::count_if(cpus.begin(), cpus.end(), [&](const cpu_info& o) {
+            return o.package == c.package and o.core == c.core and o.cpu < c.cpu;
+        });
+        order.emplace_back(rank, c.package, c.core, c.cpu);
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<int> ret;
+    for (const auto& o : order)
+        ret.push_back(std::get<3>(o));
+    return ret;
+}
+
+inline bool pin_thread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+inline bool pin_this_thread(int cpu) {
+    return pin_thread(pthread_self(), cpu);
+}
+
+// Temporarily move the calling thread to `cpu`, e.g. so that memory it first touches is allocated on that
+// CPU's NUMA node. The original affinity is restored on destruction.
+class cpu_binding {
+public:
+    explicit cpu_binding(int cpu) {
+        saved = cpu >= 0 and pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+        if (saved)
+            pin_this_thread(cpu);
+    }
+
+    ~cpu_binding() {
+        if (saved)
+            pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    }
+
+    cpu_binding(const cpu_binding&) = delete;
+    cpu_binding& operator=(const cpu_binding&) = delete;
+
+private:
+    cpu_set_t mask;
+    bool saved;
+};
+
+#endif /* TOPOLOGY_H_ */
@@ -0,0 +1,127 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Timeline of begin/end spans, exported in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread (or coroutine) records into a trace_track of its own, preallocated at registration, so recording
+// is a bounds check and three stores, without locks or shared writes. Spans that do not fit are counted and dropped.
+// Queue waits are only recorded when they last at least min_wait, so non-blocking pushes and pops don't flood the buffer.
+class trace_track {
+public:
+    trace_track(std::string name, int tid, std::size_t capacity, std::uint64_t min_wait)
+        : name(std::move(name)), tid(tid), min_wait(min_wait) {
+        events.reserve(capacity);
+    }
+
+    static std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(const char* what, std::uint64_t begin, std::uint64_t end) {
+        if (events.size() < events.capacity())
+            events.push_back({ what, begin, end });
+        else
+            dropped++;
+    }
+
+    void record_wait(const char* what, std::uint64_t begin, std::uint64_t end) {
+        if (end - begin >= min_wait)
+            record(what, begin, end);
+    }
+
+private:
+    friend class tracer;
+
+    struct event {
+        const char* what;
+        std::uint64_t begin;
+        std::uint64_t end;
+    };
+
+    std::string name;
+    int tid;
+    std::uint64_t min_wait;
+    std::vector<event> events;
+    std::uint64_t dropped = 0;
+};
+
+// RAII span on a track; does nothing (not even read the clock) when the track is null.
+class trace_span {
+public:
+    trace_span(trace_track* track, const char* what, bool wait = false)
+        : track(track), what(what), wait(wait), begin(track ? trace_track::now() : 0) {}
+
+    ~trace_span() {
+        if (not track)
+            return;
+        if (wait)
+            track->record_wait(what, begin, trace_track::now());
+        else
+            track->record(what, begin, trace_track::now());
+    }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+private:
+    trace_track* track;
+    const char* what;
+    bool wait;
+    std::uint64_t begin;
+};
+
+class tracer {
+public:
+    explicit tracer(std::size_t events_per_track = 1 << 20,
+                    std::chrono::nanoseconds min_wait = std::chrono::microseconds(10))
+        : events_per_track(events_per_track), min_wait(min_wait.count()), t0(trace_track::now()) {}
+
+    trace_track& add_track(std::string name) {
+        std::lock_guard<std::mutex> lock(mtx);
+        int tid = tracks.size() + 1;
+        return tracks.emplace_back(std::move(name), tid, events_per_track, min_wait);
+    }
+
+    // Only call once all tracks have stopped recording.
+    void write_json(std::ostream& os) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        int pid = getpid();
+        auto flags = os.flags();
+        auto precision = os.precision(3);
+        os << std::fixed << "{\"traceEvents\":[\n";
+        const char* sep = "";
+        for (const auto& t : tracks) {
+            os << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << t.tid
+               << ",\"args\":{\"name\":\"" << t.name << "\"}}";
+            sep = ",\n";
+            for (const auto& e : t.events)
+                os << sep << "{\"name\":\"" << e.what << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << t.tid
+                   << ",\"ts\":" << (e.begin - t0) / 1000.0 << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+            if (t.dropped)
+                os << sep << "{\"name\":\"dropped " << t.dropped << " spans\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << pid
+                   << ",\"tid\":" << t.tid << ",\"ts\":" << (t.events.empty() ? 0.0 : (t.events.back().end - t0) / 1000.0) << "}";
+        }
+        os << "\n]}\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::size_t events_per_track;
+    std::uint64_t min_wait;
+    std::uint64_t t0;
+    std::deque<trace_track> tracks;
+};
+
+#endif /* TRACE_H_ */
@@ -1,10 +1,15 @@
+// With the default --ops, 8 threads are 4 producers racing each other and 4 consumers racing each other.
+#define DEFAULT_THREADS 2, 8
+#include "test_main.h"
+#include "cache_aligned.h"
+#include "mpmc_ring.h"
+#include "ms_queue.h"
 #include <queue>
 #include <mutex>
 #include <thread>
 #include <chrono>
-#include <cassert>
-
-using namespace std::literals::chrono_literals;
+#include <cstdint>
+#include <vector>
 
 template<class T>
 class tsfifo {
@@ -24,33 +29,96 @@ public:
     T pop() {
         std::lock_guard<std::mutex> lock(m_mtx);
         if (m_data.empty()) return T{};
-        T ret = std::move(m_data.back());
+        T ret = std::move(m_data.front());
         m_data.pop();
         return ret;
     }
+
+    // empty() followed by pop() races with other consumers; this doesn't.
+    bool try_pop(T& value) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_data.empty()) return false;
+        value = std::move(m_data.front());
+        m_data.pop();
+        return true;
+    }
 };
 
-int main()
+named_option s_items("items", "Items pushed by every producer", 10000);
+named_option s_ring_capacity("ring-capacity", "Capacity of the bounded ring", 1024);
+
+// Stress test of a multi-producer multi-consumer queue: threads running op 1 (see --ops) are producers, which
+// push s_items values each, and the others are consumers, which pop until all values have been popped.
+// Every value carries its producer and sequence number, and every consumer checks that it sees each
+// producer's values in the order they were pushed, and that none is popped twice or lost.
+template<class Queue>
+bool stress(Queue& q, int n)
 {
-    std::vector<std::thread> threads;
-    tsfifo<int> q;
-
-    for (int i = 1; i <= 100; i++) {
-        threads.emplace_back([&] {
-            for (int j = 0; j < 10000; j++) {
-                while (q.empty()) std::this_thread::sleep_for(1ms);
-                assert(q.pop() > 0);
-            }
-        });
-        threads.emplace_back([&] {
-            for (int j = 0; j < 10000; j++) {
-                q.push(i + j * 10);
-            }
-        });
+    int producers = 0;
+    for (int i = 0; i < n; i++)
+        producers += op_of_thread(i) == 1;
+    if (producers == 0 or producers == n)
+    {
+        std::cerr << "needs producers and consumers, see --ops\n";
+        return false;
     }
+    const long total = long(producers) * s_items;
+    std::atomic<long> popped{0};
+    per_thread<long> sums(n);
+    per_thread<bool> ordered(n);
+    auto elapsed = run_threads(n, [&](int thread) {
+        if (op_of_thread(thread) == 1)
+        {
+            for (int j = 0; j < s_items; j++)
+                q.push(std::uint64_t(thread) << 32 | j);
+            return;
+        }
+        std::vector<long> last(n, -1);
+        long sum = 0;
+        bool in_order = true;
+        std::uint64_t value;
+        while (popped.load(std::memory_order_relaxed) < total)
+        {
+            if (not q.try_pop(value))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            popped.fetch_add(1, std::memory_order_relaxed);
+            long producer = value >> 32, seq = value & 0xffffffff;
+            in_order = in_order and seq > last[producer];
+            last[producer] = seq;
+            sum += seq;
+        }
+        sums[thread] = sum;
+        ordered[thread] = in_order;
+    });
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::cout << n << " threads: it took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+              << " ms, " << ns / total << " ns/item, " << 1e3 * total / ns << " Mitems/s.\n";
+    record_sample(std::to_string(n) + " threads", ns / total, "ns/item");
 
-    for (auto& thread : threads)
-        thread.join();
+    long expected = long(producers) * s_items * (s_items - 1) / 2;
+    bool ok = popped == total and sums.reduce(0L, std::plus<>()) == expected;
+    for (int i = 0; i < n; i++)
+        ok = ok and (op_of_thread(i) == 1 or ordered[i]);
+    return ok;
+}
 
-    return 0;
+template<class Queue, class... Args>
+bool run(Args... args)
+{
+    bool ok = true;
+    for (int n : s_threads)
+    {
+        Queue q(args...);
+        ok = stress(q, n) and ok;
+        std::uint64_t value;
+        ok = not q.try_pop(value) and ok;
+    }
+    return ok;
 }
+
+named_test s_mutex_queue("mutex_queue", []() { return run<tsfifo<std::uint64_t>>(); });
+named_test s_ms_queue("ms_queue", []() { return run<ms_queue<std::uint64_t>>(); });
+named_test s_mpmc_ring("mpmc_ring", []() { return run<mpmc_ring<std::uint64_t>>(std::size_t(s_ring_capacity)); });
@@ -0,0 +1,356 @@
+#include "pipeline.h"
+#ifdef HAVE_COROUTINES
+#include "coro_pipeline.h"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+// Converts the XML written by impl1/2/3 back to JSON, the reverse of json_as_xml.
+//
+// Only that dialect is understood: an XML declaration, a <doc> element, elements without attributes,
+// text escaped as &lt; &gt; &amp;, and the pretty layout (an empty object or array is an element containing
+// just a line break and its closing tag's indentation). Whatever the XML does not tell is guessed:
+// elements whose children are all <item>s are arrays, other elements with children are objects, text that is
+// true, false or a JSON number is that, and all other text is a string; null comes back as "", and empty
+// objects and arrays as [].
+//
+// The document is split at its top-level elements, which are converted on parallel lanes, and written in order.
+
+struct top_level_item {
+    std::string_view xml;   // the whole element, from its opening '<' to its closing '>'
+    bool keyed;             // the document is an object: write the element's tag as key
+};
+
+// Appends `s` as a JSON string, unescaping the XML entities on the way.
+void append_json_string(std::string& out, std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (std::size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (c == '&') {
+            if (s.compare(i, 4, "&lt;") == 0)       { out += '<'; i += 3; continue; }
+            if (s.compare(i, 4, "&gt;") == 0)       { out += '>'; i += 3; continue; }
+            if (s.compare(i, 5, "&amp;") == 0)      { out += '&'; i += 4; continue; }
+        }
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (std::uint8_t(c) < 0x20) {
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 15];
+                }
+                else
+                    out += c;
+        }
+    }
+    out += '"';
+}
+
+// JSON number grammar: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+bool is_json_number(std::string_view s) {
+    std::size_t i = 0;
+    auto digits = [&] {
+        std::size_t start = i;
+        while (i < s.size() and s[i] >= '0' and s[i] <= '9')
+            i++;
+        return i > start;
+    };
+    if (i < s.size() and s[i] == '-')
+        i++;
+    if (i < s.size() and s[i] == '0')
+        i++;
+    else if (not digits())
+        return false;
+    if (i < s.size() and s[i] == '.' and (++i, not digits()))
+        return false;
+    if (i < s.size() and (s[i] == 'e' or s[i] == 'E')) {
+        i++;
+        if (i < s.size() and (s[i] == '+' or s[i] == '-'))
+            i++;
+        if (not digits())
+            return false;
+    }
+    return i == s.size();
+}
+
+class item_converter {
+public:
+    using input_t = top_level_item;
+    using output_t = std::string;
+
+    explicit item_converter(std::atomic<bool>* failed) : failed(*failed) {}
+
+    void operator()(top_level_item&& item) {
+        p = item.xml.data();
+        end = p + item.xml.size();
+        if (not element(1, item.keyed) or p != end) {
+            failed = true;
+            out += "null";
+        }
+    }
+
+    std::string flush() {
+        std::string ret;
+        std::swap(ret, out);
+        return ret;
+    }
+
+private:
+    void skip_space() {
+        while (p != end and (*p == ' ' or *p == '\n' or *p == '\r' or *p == '\t'))
+            p++;
+    }
+
+    // Converts the element at p, which is indented `level` times in the pretty layout.
+    bool element(std::size_t level, bool keyed) {
+        if (p == end or *p != '<')
+            return false;
+        const char* tag_end = static_cast<const char*>(std::memchr(p, '>', end - p));
+        if (not tag_end)
+            return false;
+        std::string_view tag(p + 1, tag_end - p - 1);
+        p = tag_end + 1;
+        if (keyed) {
+            append_json_string(out, tag);
+            out += ':';
+        }
+
+        const char* text_end = static_cast<const char*>(std::memchr(p, '<', end - p));
+        if (not text_end or text_end + 1 == end)
+            return false;
+        if (text_end[1] != '/') {
+            if (not children(level))
+                return false;
+        }
+        else {
+            value(std::string_view(p, text_end - p), level);
+            p = text_end;
+        }
+
+        // </tag>
+        if (std::size_t(end - p) < tag.size() + 3 or p[1] != '/' or std::string_view(p + 2, tag.size()) != tag
+                or p[tag.size() + 2] != '>')
+            return false;
+        p += tag.size() + 3;
+        return true;
+    }
+
+    // Converts the children as an object, then drops the keys again if they all turn out to be "item".
+    // `keys` holds where every child's key starts and ends in `out`; nested elements use the part above `base`.
+    bool children(std::size_t level) {
+        std::size_t open = out.size();
+        std::size_t base = keys.size();
+        bool all_items = true;
+        out += '{';
+        for (;;) {
+            skip_space();
+            if (std::size_t(end - p) < 2)
+                return false;
+            if (p[1] == '/')
+                break;
+            if (keys.size() != base)
+                out += ',';
+            all_items = all_items and std::string_view(p, std::min<std::size_t>(end - p, 6)) == "<item>";
+            keys.push_back(out.size());
+            if (not element(level + 1, true))
+                return false;
+            // The key is "tag": followed by the value; find where the value starts.
+            keys.push_back(keys.back() + key_length(keys.back()));
+        }
+        if (all_items) {
+            std::size_t write = keys[base];
+            for (std::size_t i = base; i < keys.size(); i += 2) {
+                std::size_t from = keys[i + 1];
+                std::size_t to = i + 2 < keys.size() ? keys[i + 2] : out.size();
+                std::copy(out.begin() + from, out.begin() + to, out.begin() + write);
+                write += to - from;
+            }
+            out.resize(write);
+            out[open] = '[';
+            out += ']';
+        }
+        else
+            out += '}';
+        keys.resize(base);
+        return true;
+    }
+
+    // Length of the "key": at `pos` in out.
+    std::size_t key_length(std::size_t pos) const {
+        std::size_t i = pos + 1;
+        while (out[i] != '"')
+            i += out[i] == '\\' ? 2 : 1;
+        return i + 2 - pos;
+    }
+
+    void value(std::string_view text, std::size_t level) {
+        if (text.size() == 4 * level + 1 and text[0] == '\n'
+                and text.find_first_not_of(' ', 1) == std::string_view::npos)
+            out += "[]";
+        else if (text == "true" or text == "false" or is_json_number(text))
+            out += text;
+        else
+            append_json_string(out, text);
+    }
+
+    std::atomic<bool>& failed;
+    const char* p = nullptr;
+    const char* end = nullptr;
+    std::vector<std::size_t> keys;
+    std::string out;
+};
+
+// Splits the <doc> element into its children. Text never contains '<', so counting opening and closing tags
+// is enough to find where every child ends.
+bool split_document(std::string_view doc, std::vector<std::string_view>& items) {
+    std::size_t pos = 0;
+    auto skip_space = [&] {
+        pos = doc.find_first_not_of(" \n\r\t", pos);
+    };
+    skip_space();
+    if (pos == std::string_view::npos)
+        return false;
+    if (doc.compare(pos, 2, "<?") == 0) {
+        pos = doc.find("?>", pos);
+        if (pos == std::string_view::npos)
+            return false;
+        pos += 2;
+        skip_space();
+        if (pos == std::string_view::npos)
+            return false;
+    }
+    if (doc.compare(pos, 5, "<doc>"))
+        return false;
+    pos += 5;
+    for (;;) {
+        skip_space();
+        if (pos == std::string_view::npos)
+            return false;
+        if (doc.compare(pos, 6, "</doc>") == 0)
+            return true;
+        std::size_t start = pos;
+        int depth = 0;
+        do {
+            pos = doc.find('<', pos);
+            if (pos == std::string_view::npos or pos + 1 == doc.size())
+                return false;
+            depth += doc[pos + 1] == '/' ? -1 : 1;
+            pos++;
+        } while (depth);
+        pos = doc.find('>', pos);
+        if (pos == std::string_view::npos)
+            return false;
+        items.push_back(doc.substr(start, ++pos - start));
+    }
+}
+
+struct options {
+    std::size_t width = 2;
+    bool coro = false;
+};
+
+template<class Pipeline>
+bool convert(std::string_view doc, const options& opts) {
+    std::vector<std::string_view> items;
+    if (not split_document(doc, items))
+        return false;
+    // Arrays are written as <item>s, everything else is an object.
+    bool keyed = std::any_of(items.begin(), items.end(), [](std::string_view item) {
+        return item.compare(0, 6, "<item>");
+    });
+
+    std::atomic<bool> failed{false};
+    std::cout << (keyed ? "{" : "[");
+    {
+        pipeline_config config;
+        config.width = opts.width;
+        config.input_name = "splitter";
+        config.stage_name = "converter";
+        config.sink_name = "writer";
+        bool first = true;
+        Pipeline converters(config, [&first](std::string&& s) {
+            std::cout << (first ? "\n" : ",\n") << s;
+            first = false;
+        }, &failed);
+        for (auto item : items) {
+            converters.push(top_level_item{ item, keyed });
+            converters.next();
+        }
+    }
+    std::cout << (keyed ? "\n}\n" : "\n]\n");
+    return not failed;
+}
+
+int main(int argc, const char** argv) {
+    const char* prog_name = argv[0];
+    auto usage = [&](int ret) {
+        std::cerr << "Usage: " << prog_name << " [option*] <input.xml >output.json\n"
+                << "Options are:\n"
+                << "  -h|--help       Display this help message\n"
+                << "  -w|--width      Number of converters (default 2)\n"
+                << "  -m|--mode       threads: a thread per converter and one for the writer\n"
+                << "                  coro:    converters and writer are coroutines on the main thread\n"
+                << "                  Defaults to coro on hosts with at most 2 cores\n";
+        return ret;
+    };
+    options opts;
+#ifdef HAVE_COROUTINES
+    opts.coro = std::thread::hardware_concurrency() <= 2;
+#endif
+    while (++argv, --argc)
+    {
+        if (not std::strcmp(argv[0], "-h") or not std::strcmp(argv[0], "--help"))
+            return usage(0);
+        else if (not std::strcmp(argv[0], "-w") or not std::strcmp(argv[0], "--width"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            int width = std::atoi(argv[0]);
+            if (width < 1) return usage(1);
+            opts.width = width;
+        }
+        else if (not std::strcmp(argv[0], "-m") or not std::strcmp(argv[0], "--mode"))
+        {
+            if (not (++argv, --argc)) return usage(1);
+            if (not std::strcmp(argv[0], "threads"))
+                opts.coro = false;
+#ifdef HAVE_COROUTINES
+            else if (not std::strcmp(argv[0], "coro"))
+                opts.coro = true;
+#endif
+            else
+                return usage(1);
+        }
+        else
+            return usage(1);
+    }
+
+    std::string doc;
+    char buf[1 << 16];
+    for (ssize_t n; (n = read(STDIN_FILENO, buf, sizeof(buf))) > 0;)
+        doc.append(buf, n);
+
+    prctl(PR_SET_NAME, "splitter", nullptr, nullptr, nullptr);
+    std::ios::sync_with_stdio(false);
+#ifdef HAVE_COROUTINES
+    bool ok = opts.coro ? convert<coro_pipeline<item_converter>>(doc, opts) : convert<pipeline<item_converter>>(doc, opts);
+#else
+    bool ok = convert<pipeline<item_converter>>(doc, opts);
+#endif
+    if (not ok)
+        std::cerr << prog_name << ": input is not XML as written by json_as_xml\n";
+    return ok ? 0 : 1;
+}
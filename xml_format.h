@@ -0,0 +1,191 @@
+#ifndef XML_FORMAT_H_
+#define XML_FORMAT_H_
+
+#include "number_format.h"
+#include <nlohmann/json.hpp>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// For every byte, the text written in its place; empty for bytes written as they are.
+using escape_table = std::array<std::string_view, 256>;
+
+constexpr escape_table markup_escapes() {
+    escape_table t{};
+    t['<'] = "&lt;";
+    t['>'] = "&gt;";
+    t['&'] = "&amp;";
+    return t;
+}
+
+// Output policies for xml_formatter. Everything is constexpr, so the formatter is compiled once per policy
+// with the choices folded in: no runtime checks of the indent or the layout per value.
+struct pretty_xml {
+    static constexpr std::string_view indent = "    ";
+    static constexpr bool compact = false;
+    static constexpr escape_table escapes = markup_escapes();
+    static constexpr float_style floats = float_style::general;
+};
+
+struct compact_xml {
+    static constexpr std::string_view indent = "";
+    static constexpr bool compact = true;       // no indentation and no line breaks at all
+    static constexpr escape_table escapes = markup_escapes();
+    static constexpr float_style floats = float_style::general;
+};
+
+// A policy with another way of writing floating point numbers.
+template<class Layout, float_style Floats>
+struct with_floats : Layout {
+    static constexpr float_style floats = Floats;
+};
+
+// The SAX events of one top-level item, as handed from the parser to an xml_formatter.
+struct xml_events {
+    struct begin_group_t {};
+    struct end_group_t {};
+    struct key_t { std::string s; };
+    struct lexeme_t { std::string s; }; // a number as written in the input
+
+    using json = nlohmann::json;
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using string_t = json::string_t;
+
+    using input_t = std::variant<const char*,
+                                 number_integer_t,
+                                 number_unsigned_t,
+                                 number_float_t,
+                                 lexeme_t,
+                                 string_t,
+                                 begin_group_t,
+                                 end_group_t,
+                                 key_t>;
+};
+
+// Pipeline stage turning the events of one top-level item into XML: a value is an element named after its
+// key ("item" in arrays), objects and arrays are elements containing their members.
+template<class Policy>
+struct xml_formatter : xml_events {
+    using output_t = std::string;
+
+    std::vector<std::string> stack = { "" };
+    std::string out;
+
+    std::string_view current_tag() const {
+        if (stack.back().empty()) return "item";
+        else                      return stack.back();
+    }
+
+    void indent() {
+        if constexpr (not Policy::compact and not Policy::indent.empty())
+            for (std::size_t i = 0; i < stack.size(); i++)
+                out += Policy::indent;
+    }
+
+    void newline() {
+        if constexpr (not Policy::compact)
+            out += '\n';
+    }
+
+    void open_tag() {
+        indent();
+        out += '<';
+        out += current_tag();
+        out += '>';
+    }
+
+    void close_tag() {
+        out += "</";
+        out += current_tag();
+        out += '>';
+        newline();
+    }
+
+    // Whether the parser should send floats as lexeme_t rather than number_float_t.
+    static constexpr bool wants_lexemes = Policy::floats == float_style::lexeme;
+
+    void dump(const char* value) {
+        open_tag();
+        out += value;
+        close_tag();
+    }
+
+    void dump(number_integer_t value) {
+        char buf[max_number_chars];
+        open_tag();
+        out.append(buf, format_signed(buf, value));
+        close_tag();
+    }
+
+    void dump(number_unsigned_t value) {
+        char buf[max_number_chars];
+        open_tag();
+        out.append(buf, format_unsigned(buf, value));
+        close_tag();
+    }
+
+    void dump(number_float_t value) {
+        char buf[max_number_chars];
+        open_tag();
+        out.append(buf, format_float(buf, value, Policy::floats));
+        close_tag();
+    }
+
+    void dump(lexeme_t&& value) {
+        open_tag();
+        out += value.s;
+        close_tag();
+    }
+
+    void dump(string_t&& value) {
+        open_tag();
+        // Copy runs of bytes that need no escaping in one go.
+        const char* run = value.data();
+        const char* end = value.data() + value.size();
+        for (const char* p = run; p != end; p++) {
+            std::string_view escape = Policy::escapes[std::uint8_t(*p)];
+            if (escape.empty())
+                continue;
+            out.append(run, p);
+            out += escape;
+            run = p + 1;
+        }
+        out.append(run, end);
+        close_tag();
+    }
+
+    void dump(begin_group_t&&) {
+        open_tag();
+        newline();
+        stack.emplace_back();
+    }
+
+    void dump(end_group_t&&) {
+        stack.pop_back();
+        indent();
+        close_tag();
+    }
+
+    void dump(key_t&& value) {
+        stack.back() = std::move(value.s);
+    }
+
+    void operator()(input_t&& value) {
+        std::visit([&](auto&& arg) {
+            dump(std::move(arg));
+        }, std::move(value));
+    }
+
+    output_t flush() {
+        output_t ret;
+        std::swap(ret, out);
+        return ret;
+    }
+};
+
+#endif /* XML_FORMAT_H_ */